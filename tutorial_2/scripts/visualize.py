@@ -25,27 +25,179 @@ from pathlib import Path
 
 
 # ---------------------------------------------------------------------------
-# Binary format (written by C++ --visualize)
-#   int32  n_particles   — number of subsampled particles per frame
-#   int32  n_frames      — total number of frames
-#   per frame:
-#     n_particles * float32  x
-#     n_particles * float32  y
-#     n_particles * float32  z
+# Binary format v2 (written by C++ --visualize, see src/snapshot.h)
+#   SnapshotFileHeader  (64 bytes)
+#     char[8] magic "GALSNAP\0", uint32 version, uint32 alignment,
+#     uint32 max_frames, uint32 n_frames, uint64 index_offset, 32 reserved
+#   SnapshotIndexEntry[max_frames]  (uint64 offset, uint64 bytes)
+#   per frame, starting at a page-aligned offset:
+#     SnapshotFrameHeader (64 bytes)
+#       uint32 magic, uint32 codec, int64 iteration, float64 sim_time,
+#       uint32 n_particles, uint32 stride, uint64 payload_bytes, 24 reserved
+#     payload (codec 0 = raw): n_particles float32 x, then y, then z
+#     payload (codec 1 = qdelta): quantised, predicted, bit-packed positions;
+#       see src/snapshot_codec.h and decode_qdelta() below
+#
+# Only the first n_frames index entries are valid, so a file from a run that
+# was killed part-way through still opens with every completed frame.
+#
+# Legacy v1 files (int32 n_particles, int32 n_frames, raw frames) are still
+# accepted; they have no magic and are detected by its absence.
 # ---------------------------------------------------------------------------
 
+SNAPSHOT_MAGIC = b'GALSNAP\0'
+FILE_HEADER    = struct.Struct('<8sIIIIQ32x')
+INDEX_ENTRY    = np.dtype([('offset', '<u8'), ('bytes', '<u8')])
+FRAME_HEADER   = struct.Struct('<IIqdIIQ24x')
+FRAME_MAGIC    = 0x454d5246
+CODEC_RAW      = 0
+CODEC_QDELTA   = 1
+
+QDELTA_HEADER  = struct.Struct('<II3f3f3Q8x')
+QDELTA_KEY, QDELTA_DELTA, QDELTA_PREDICT = 0, 1, 2
+
+
+def unpack_axis(buf, n, block):
+    """Undo the per-block bit-packing of one axis stream -> uint32[n]."""
+    n_blocks = (n + block - 1) // block
+    table = (n_blocks + 7) // 8 * 8
+    widths = np.frombuffer(buf, dtype=np.uint8, count=n_blocks)
+    sizes = widths.astype(np.int64) * (block // 8)
+    starts = table + np.concatenate(([0], np.cumsum(sizes)[:-1]))
+    data = np.frombuffer(buf, dtype=np.uint8)
+    out = np.zeros((n_blocks, block), dtype=np.uint32)
+    for w in np.unique(widths):
+        if w == 0:
+            continue
+        sel = np.nonzero(widths == w)[0]
+        nbytes = block * int(w) // 8
+        raw = data[starts[sel, None] + np.arange(nbytes)]
+        bits = np.unpackbits(raw, axis=1, bitorder='little').reshape(len(sel), block, w)
+        out[sel] = bits.astype(np.uint32) @ (np.uint32(1) << np.arange(w, dtype=np.uint32))
+    return out.reshape(-1)[:n]
+
+
+def decode_qdelta(payload, n, prev, prev2):
+    """Decode one qdelta frame given the two previous quantised frames.
+
+    Returns (kind, q, origin, quantum) where q is int64[3, n] grid coordinates.
+    """
+    kind, block, *rest = QDELTA_HEADER.unpack(payload[:QDELTA_HEADER.size].tobytes())
+    origin = np.array(rest[0:3], dtype=np.float32)
+    quantum = np.array(rest[3:6], dtype=np.float32)
+    axis_bytes = rest[6:9]
+    q = np.empty((3, n), dtype=np.int64)
+    off = QDELTA_HEADER.size
+    for a in range(3):
+        r = unpack_axis(payload[off:off + axis_bytes[a]], n, block).astype(np.int64)
+        off += axis_bytes[a]
+        if kind == QDELTA_KEY:
+            q[a] = r
+            continue
+        d = (r >> 1) ^ -(r & 1)                      # undo zigzag
+        if kind == QDELTA_DELTA:
+            q[a] = prev[a] + d
+        else:
+            q[a] = 2 * prev[a] - prev2[a] + d
+    return kind, q, origin, quantum
+
+
+class SnapshotFile:
+    """Random-access view of a snapshot file.
+
+    The file is memory-mapped, so indexing a frame only touches that frame's
+    pages; nothing else is read.  snap[i] returns (x, y, z) float32 arrays and
+    snap.frame_info(i) returns the per-frame header as a dict.
+    """
+
+    def __init__(self, path):
+        self.path = Path(path)
+        self._buf = np.memmap(self.path, dtype=np.uint8, mode='r')
+        self._qcache = None                    # (frame, q, q_prev) of last qdelta decode
+        head = self._buf[:FILE_HEADER.size].tobytes()
+        if head[:8] == SNAPSHOT_MAGIC:
+            (_, self.version, self.alignment, self.max_frames, n_frames,
+             index_offset) = FILE_HEADER.unpack(head)
+            self._index = np.frombuffer(self._buf, dtype=INDEX_ENTRY,
+                                        count=n_frames, offset=index_offset)
+        else:
+            self.version = 1
+            self._index = self._legacy_index(head)
+
+    def _legacy_index(self, head):
+        n_particles, n_frames = struct.unpack('ii', head[:8])
+        nbytes = 3 * n_particles * 4
+        # Drop any trailing partial frame rather than failing outright.
+        n_frames = min(n_frames, (len(self._buf) - 8) // nbytes)
+        index = np.zeros(n_frames, dtype=INDEX_ENTRY)
+        index['offset'] = 8 + np.arange(n_frames, dtype=np.uint64) * nbytes
+        index['bytes'] = nbytes
+        self._legacy_n = n_particles
+        return index
+
+    def __len__(self):
+        return len(self._index)
+
+    def frame_info(self, i):
+        off = int(self._index[i]['offset'])
+        if self.version == 1:
+            return dict(codec=CODEC_RAW, iteration=None, sim_time=None,
+                        n_particles=self._legacy_n, stride=None,
+                        payload_offset=off, payload_bytes=int(self._index[i]['bytes']))
+        magic, codec, iteration, sim_time, n, stride, payload_bytes = \
+            FRAME_HEADER.unpack(self._buf[off:off + FRAME_HEADER.size].tobytes())
+        if magic != FRAME_MAGIC:
+            raise ValueError(f"{self.path}: frame {i} has a bad header")
+        return dict(codec=codec, iteration=iteration, sim_time=sim_time,
+                    n_particles=n, stride=stride,
+                    payload_offset=off + FRAME_HEADER.size, payload_bytes=payload_bytes)
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += len(self)
+        if not 0 <= i < len(self):
+            raise IndexError(i)
+        info = self.frame_info(i)
+        if info['codec'] == CODEC_QDELTA:
+            return self._read_qdelta(i)
+        if info['codec'] != CODEC_RAW:
+            raise ValueError(f"{self.path}: unsupported frame codec {info['codec']}")
+        n = info['n_particles']
+        xyz = np.frombuffer(self._buf, dtype='<f4', count=3 * n,
+                            offset=info['payload_offset']).reshape(3, n)
+        return xyz[0], xyz[1], xyz[2]
+
+
+    def _payload(self, info):
+        off = info['payload_offset']
+        return self._buf[off:off + info['payload_bytes']]
+
+    def _read_qdelta(self, i):
+        # Delta frames depend on the frames before them, back to the last key
+        # frame. Sequential access reuses the previous decode; random access
+        # walks back through the frame headers only, then decodes forward.
+        if self._qcache is not None and self._qcache[0] == i - 1:
+            start, prev, prev2 = i, self._qcache[1], self._qcache[2]
+        else:
+            start = i
+            while start > 0 and QDELTA_HEADER.unpack(
+                    self._payload(self.frame_info(start))[:QDELTA_HEADER.size].tobytes())[0] != QDELTA_KEY:
+                start -= 1
+            prev = prev2 = None
+        for k in range(start, i + 1):
+            info = self.frame_info(k)
+            _, q, origin, quantum = decode_qdelta(self._payload(info), info['n_particles'],
+                                                  prev, prev2)
+            prev2, prev = prev, q
+        self._qcache = (i, prev, prev2)
+        xyz = origin[:, None] + prev.astype(np.float32) * quantum[:, None]
+        return xyz[0], xyz[1], xyz[2]
+
+
 def read_snapshots(path):
-    with open(path, 'rb') as f:
-        n_particles, n_frames = struct.unpack('ii', f.read(8))
-        frames = []
-        for _ in range(n_frames):
-            nbytes = n_particles * 4
-            x = np.frombuffer(f.read(nbytes), dtype=np.float32).copy()
-            y = np.frombuffer(f.read(nbytes), dtype=np.float32).copy()
-            z = np.frombuffer(f.read(nbytes), dtype=np.float32).copy()
-            frames.append((x, y, z))
-    print(f"Loaded {n_frames} frames, {n_particles} particles each.")
-    return frames
+    snap = SnapshotFile(path)
+    print(f"Loaded {len(snap)} frames (format v{snap.version}).")
+    return snap
 
 
 def make_gif(frames, out_path):
@@ -1,22 +1,20 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cmath>
 #include <vector>
 
+#include "checkpoint.h"
+#include "particles_aos.h"
+#include "snapshot.h"
+
 // Array-of-Structures layout.
-// Each ParticleAoS is exactly 64 bytes — one full cache line.
+// Each ParticleAoS (particles_aos.h) is exactly 64 bytes — one full cache line.
 // The hot position-update loop only reads/writes x, y, z, vx, vy, vz
 // (6 floats = 24 bytes), so 40 of the 64 bytes loaded per particle are wasted.
-struct ParticleAoS {
-    float x, y, z;                   // position      (12 bytes) — used in hot loop
-    float vx, vy, vz;                // velocity      (12 bytes) — used in hot loop
-    float mass, charge, temperature; // properties    (12 bytes) — not used in hot loop
-    float pressure, energy, density; //               (12 bytes) — not used in hot loop
-    float spin_x, spin_y, spin_z;    //               (12 bytes) — not used in hot loop
-    float pad;                        // padding        (4 bytes)
-    // Total: 64 bytes = 1 cache line. Hot loop uses 24 / 64 = 37.5%.
-};
-
+//
+// The loop sits on the same lines as in soa_optimized.cpp, so the two ATP
+// source views line up.
 static void update_positions(ParticleAoS* p, int n, float dt) {
     for (int i = 0; i < n; ++i) {
         p[i].x += p[i].vx * dt;
@@ -25,127 +23,100 @@ static void update_positions(ParticleAoS* p, int n, float dt) {
     }
 }
 
-// ----------------------------------------------------------------------------
-// Minimal LCG for reproducible, dependency-free galaxy initialisation.
-// Not used in the hot loop — only called once during setup.
-// ----------------------------------------------------------------------------
-static unsigned int lcg_state = 0x12345678u;
-
-static float lcg_float() {
-    lcg_state = lcg_state * 1664525u + 1013904223u;
-    return (float)(lcg_state >> 8) * (1.0f / 16777216.0f);
-}
-
-static float lcg_gauss() {
-    // Box-Muller transform: two uniform samples → one Gaussian sample.
-    float u = lcg_float() + 1e-7f;
-    float v = lcg_float();
-    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * 3.14159265f * v);
-}
-
-// Initialise particles as a two-arm logarithmic spiral galaxy.
-// Particles are placed on spiral arms with a flat rotation curve so that
-// differential rotation slowly winds the arms further during the simulation.
-static void init_galaxy(ParticleAoS* p, int n) {
-    const float PI      = 3.14159265f;
-    const float v0      = 2.0f;   // orbital speed (flat rotation curve)
-    const float winding = 3.5f;   // logarithmic spiral winding constant
-    const float r_min   = 0.5f;   // inner edge of disk
-    const float r_scale = 2.2f;   // exponential scale radius
-    const float r_max   = 9.0f;   // outer cutoff
-    const float scatter = 0.30f;  // angular scatter around arm centreline
-    const float z_scale = 0.15f;  // disk half-thickness
-
-    for (int i = 0; i < n; ++i) {
-        // Distribute particles evenly across four arms (offset by π/2 each).
-        float arm_offset = (i % 4) * (PI / 2.0f);
-
-        // Sample radius from an exponential distribution, clamped to [r_min, r_max].
-        float r = r_min - r_scale * logf(lcg_float() + 1e-7f);
-        if (r > r_max) r = r_min + (r_max - r_min) * lcg_float();
-
-        // Logarithmic spiral: θ = arm_offset + winding * ln(r / r_min) + scatter
-        float theta = arm_offset + winding * logf(r / r_min) + lcg_gauss() * scatter;
-
-        p[i].x  =  r * cosf(theta);
-        p[i].y  =  r * sinf(theta);
-        p[i].z  =  lcg_gauss() * z_scale;
-
-        // Flat rotation curve: tangential speed = v0 regardless of radius.
-        // vtan direction = (-sin θ, cos θ, 0).
-        p[i].vx =  -v0 * sinf(theta);
-        p[i].vy =   v0 * cosf(theta);
-        p[i].vz =   0.0f;
-
-        // Cold fields — present in the struct but never touched by update_positions.
-        p[i].mass        = 1.0f;
-        p[i].charge      = 0.5f;
-        p[i].temperature = 300.0f;
-        p[i].pressure    = 101325.0f;
-        p[i].energy      = 0.0f;
-        p[i].density     = 1.0f;
-        p[i].spin_x      = 0.0f;
-        p[i].spin_y      = 0.0f;
-        p[i].spin_z      = 0.0f;
-        p[i].pad         = 0.0f;
-    }
-}
-
 int main(int argc, char* argv[]) {
-    const int   N              = 1 << 20; // 1,048,576 particles — working set = 64 MB
+    int         N              = 1 << 20; // 1,048,576 particles — working set = 64 MB (--particles N)
     const int   default_iters  = 200;
     const int   vis_iters      = 1000;
     const float dt    = 0.005f;
 
     // --visualize: dump subsampled position snapshots for the Python visualiser.
     // Omit this flag when profiling with ATP to avoid I/O overhead.
-    bool do_vis = false;
+    bool do_vis     = false;
+    bool compress   = false;  // --compress: quantised delta frames (snapshot_codec.h)
+    int  vis_stride = 16;     // --vis-stride S: keep 1-in-S particles per frame
+
+    // --checkpoint-every K: atomically save full state every K iterations.
+    // --resume: start from the checkpoint instead of init_galaxy.
+    const char* ckpt_path  = "galaxy_aos.ckpt";  // --checkpoint PATH
+    int         ckpt_every = 0;
+    bool        resume     = false;
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--visualize") == 0) {
             do_vis = true;
-            break;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "--vis-stride") == 0 && i + 1 < argc) {
+            vis_stride = atoi(argv[++i]);
+            if (vis_stride < 1) vis_stride = 1;
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            ckpt_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            ckpt_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            N = atoi(argv[++i]);
         }
     }
+    if (N < 1) {
+        fprintf(stderr, "--particles must be positive\n");
+        return 1;
+    }
 
     const int iters = do_vis ? vis_iters : default_iters;
 
-    // Subsample 1-in-16 particles for compact output (~65 k points per frame).
-    const int vis_stride   = 16;
+    // Default: subsample 1-in-16 particles for compact output (~65 k points per frame).
+    // With --compress, --vis-stride 1 records every particle at a fraction of the size.
     const int vis_interval = 10;  // dump every 10 iterations
-    const int vis_n        = N / vis_stride;
     const int vis_frames   = 1 + iters / vis_interval;
 
     std::vector<ParticleAoS> particles(N);
-    init_galaxy(particles.data(), N);
-
-    FILE* vis_fp = nullptr;
-    if (do_vis) {
-        vis_fp = fopen("galaxy_aos.bin", "wb");
-        fwrite(&vis_n,      sizeof(int), 1, vis_fp);
-        fwrite(&vis_frames, sizeof(int), 1, vis_fp);
+    CheckpointField ckpt = { "particles", particles.data(), (uint64_t)N * sizeof(ParticleAoS) };
+    uint64_t seed       = GALAXY_SEED;
+    int      start_iter = 0;
+    if (resume) {
+        int64_t  saved_iter = 0;
+        uint64_t saved_seed = 0;
+        if (!checkpoint_load(ckpt_path, CHECKPOINT_LAYOUT_AOS, N, saved_iter, saved_seed, &ckpt, 1))
+            return 1;
+        start_iter = (int)saved_iter;
+        seed       = saved_seed;
+        printf("Resumed from %s at iteration %d\n", ckpt_path, start_iter);
+    } else {
+        init_galaxy(particles.data(), N, seed);
     }
 
-    // Helper: write one subsampled frame (x-array, then y-array, then z-array).
-    auto dump_frame = [&]() {
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles[j].x, sizeof(float), 1, vis_fp);
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles[j].y, sizeof(float), 1, vis_fp);
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles[j].z, sizeof(float), 1, vis_fp);
+    SnapshotWriter vis;
+    if (do_vis && !snapshot_open(vis, "galaxy_aos.bin", (uint32_t)vis_frames,
+                                compress ? SNAPSHOT_CODEC_QDELTA : SNAPSHOT_CODEC_RAW))
+        return 1;
+
+    // Helper: append one subsampled frame to the seekable snapshot file.
+    auto dump_frame = [&](int iter) {
+        if (!snapshot_write_frame(vis, iter, iter * (double)dt,
+                                  &particles[0].x, &particles[0].y, &particles[0].z,
+                                  sizeof(ParticleAoS), N, vis_stride)) {
+            fprintf(stderr, "snapshot: write failed at iteration %d\n", iter);
+            exit(1);
+        }
     };
 
-    // Frame 0: initial galaxy shape before any position update.
-    if (do_vis) dump_frame();
+    // First frame: galaxy shape before any position update (or at the resume point).
+    if (do_vis) dump_frame(start_iter);
 
-    for (int iter = 0; iter < iters; ++iter) {
+    for (int iter = start_iter; iter < iters; ++iter) {
         update_positions(particles.data(), N, dt);
 
         if (do_vis && (iter + 1) % vis_interval == 0)
-            dump_frame();
+            dump_frame(iter + 1);
+
+        if (ckpt_every > 0 && (iter + 1) % ckpt_every == 0 &&
+            !checkpoint_save(ckpt_path, CHECKPOINT_LAYOUT_AOS, N, iter + 1, seed,
+                             &ckpt, 1))
+            return 1;
     }
 
-    if (vis_fp) fclose(vis_fp);
+    snapshot_close(vis);
 
     // Checksum — must match soa_optimized for correctness verification.
     double checksum = 0.0;
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "particles_soa.h"
+#include "radix_sort.h"
+
+// ----------------------------------------------------------------------------
+// Barnes–Hut gravity over the SoA particle arrays.
+//
+// Build (every step):
+//   1. Bounding cube of x/y/z, then a 63-bit Morton key per particle
+//      (21 bits per axis) and a parallel radix sort of (key, index) pairs.
+//   2. Positions and masses are gathered into Morton order, so every tree node
+//      owns a contiguous particle range [begin, end).
+//   3. The octree is built top-down by splitting each key range into octants.
+//      Levels where every particle falls in the same octant are skipped, so
+//      each internal node has 2..8 children and the tree has < 2N nodes.
+//      Large subtrees are built as OpenMP tasks; node slots come from one
+//      atomic counter. Centre of mass is accumulated on the way back up.
+//
+// Walk (per particle, in Morton order so neighbouring threads share nodes):
+//   A node is used as a point mass when d > s/theta + delta, where s is the
+//   cell width and delta the offset of its centre of mass from the cell
+//   centre (Barnes' modified criterion, which stays safe for particles that
+//   sit inside a lopsided cell). Otherwise leaves are summed directly and
+//   internal nodes are opened. Forces use Plummer softening, so the i == j
+//   term contributes nothing and needs no special case.
+// ----------------------------------------------------------------------------
+
+struct BHParams {
+    float theta     = 0.5f;   // opening angle: smaller is more accurate and slower
+    float softening = 0.05f;  // Plummer softening length
+    float G         = 1.0f;   // gravitational constant (simulation units)
+    int   leaf_size = 16;     // max particles per leaf
+};
+
+struct BHNode {
+    float    cx, cy, cz, m;   // centre of mass and total mass
+    float    open2;           // use as a point mass when d^2 > open2
+    uint32_t child;           // first child (children are contiguous); 0 for leaves
+    uint32_t n_child;
+    uint32_t begin, end;      // particle range in Morton order
+};
+
+struct BHKey {
+    uint64_t key;
+    uint32_t index;
+    bool operator<(const BHKey& o) const {
+        return key < o.key || (key == o.key && index < o.index);
+    }
+};
+
+struct BHTree {
+    std::vector<BHNode>   nodes;
+    std::atomic<uint32_t> n_nodes;
+    std::vector<BHKey>    sorted;          // (Morton key, original index), ascending
+    std::vector<BHKey>    scratch;         // radix sort buffer
+    std::vector<float>    px, py, pz, pm;  // positions and masses in Morton order
+    float                 lo[3];           // bounding cube corner
+    float                 size;            // bounding cube edge length
+};
+
+static const int BH_KEY_LEVELS  = 21;      // Morton bits per axis
+static const int BH_TASK_CUTOFF = 4096;    // smaller subtrees are built inline
+
+// Spread the low 21 bits of v so there are two zero bits between each.
+static inline uint64_t bh_spread3(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x001f00000000ffffull;
+    v = (v | v << 16) & 0x001f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+// Integer grid coordinates (21 bits per axis) of a point inside the cube
+// [lo, lo + size)^3, clamped to the grid.
+static inline void bh_quantise(float x, float y, float z, const float lo[3], float inv_size,
+                               uint64_t q[3]) {
+    const float scale = (float)(1 << BH_KEY_LEVELS);
+    const float c[3] = { (x - lo[0]) * inv_size * scale,
+                         (y - lo[1]) * inv_size * scale,
+                         (z - lo[2]) * inv_size * scale };
+    for (int a = 0; a < 3; ++a) {
+        float v = c[a] < 0.0f ? 0.0f : c[a];
+        q[a] = v >= scale - 1.0f ? (uint64_t)(scale - 1.0f) : (uint64_t)v;
+    }
+}
+
+// Morton key of a point inside the cube [lo, lo + size)^3.
+// Octant digit layout per level: bit 2 = x, bit 1 = y, bit 0 = z.
+static inline uint64_t bh_morton(float x, float y, float z, const float lo[3], float inv_size) {
+    uint64_t q[3];
+    bh_quantise(x, y, z, lo, inv_size, q);
+    return bh_spread3(q[0]) << 2 | bh_spread3(q[1]) << 1 | bh_spread3(q[2]);
+}
+
+static inline uint32_t bh_digit(uint64_t key, int level) {
+    return (uint32_t)(key >> (3 * (BH_KEY_LEVELS - 1 - level))) & 7u;
+}
+
+static void bh_build_node(BHTree& t, const BHParams& prm, uint32_t ni,
+                          uint32_t begin, uint32_t end, int level,
+                          float cx, float cy, float cz, float half) {
+    const uint32_t leaf = (uint32_t)prm.leaf_size;
+
+    // Skip levels where the whole range sits in one octant.
+    while (end - begin > leaf && level < BH_KEY_LEVELS) {
+        uint32_t d = bh_digit(t.sorted[begin].key, level);
+        if (d != bh_digit(t.sorted[end - 1].key, level)) break;
+        half *= 0.5f;
+        cx += (d & 4) ? half : -half;
+        cy += (d & 2) ? half : -half;
+        cz += (d & 1) ? half : -half;
+        ++level;
+    }
+
+    BHNode& n = t.nodes[ni];
+    n.begin = begin;
+    n.end   = end;
+    float m = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+
+    if (end - begin <= leaf || level >= BH_KEY_LEVELS) {
+        n.child   = 0;
+        n.n_child = 0;
+        for (uint32_t k = begin; k < end; ++k) {
+            m  += t.pm[k];
+            mx += t.pm[k] * t.px[k];
+            my += t.pm[k] * t.py[k];
+            mz += t.pm[k] * t.pz[k];
+        }
+    } else {
+        // Keys in [begin, end) share every digit above this level, so the
+        // octant digit is non-decreasing and each octant is a sub-range.
+        uint32_t bounds[9];
+        bounds[0] = begin;
+        for (uint32_t d = 0; d < 8; ++d) {
+            const BHKey* first = t.sorted.data() + bounds[d];
+            const BHKey* last  = t.sorted.data() + end;
+            const BHKey* split = std::partition_point(first, last, [&](const BHKey& k) {
+                return bh_digit(k.key, level) <= d;
+            });
+            bounds[d + 1] = (uint32_t)(split - t.sorted.data());
+        }
+        uint32_t n_child = 0;
+        for (uint32_t d = 0; d < 8; ++d) n_child += bounds[d + 1] > bounds[d];
+        const uint32_t first = t.n_nodes.fetch_add(n_child);
+        n.child   = first;
+        n.n_child = n_child;
+
+        const float h = 0.5f * half;
+        uint32_t c = first;
+        for (uint32_t d = 0; d < 8; ++d) {
+            const uint32_t b = bounds[d], e = bounds[d + 1];
+            if (b == e) continue;
+            const float ccx = cx + ((d & 4) ? h : -h);
+            const float ccy = cy + ((d & 2) ? h : -h);
+            const float ccz = cz + ((d & 1) ? h : -h);
+            if (e - b > (uint32_t)BH_TASK_CUTOFF) {
+                BHTree* tp = &t;
+                const BHParams* pp = &prm;
+                #pragma omp task firstprivate(tp, pp, c, b, e, level, ccx, ccy, ccz, h)
+                bh_build_node(*tp, *pp, c, b, e, level + 1, ccx, ccy, ccz, h);
+            } else {
+                bh_build_node(t, prm, c, b, e, level + 1, ccx, ccy, ccz, h);
+            }
+            ++c;
+        }
+        #pragma omp taskwait
+
+        for (uint32_t k = first; k < first + n_child; ++k) {
+            const BHNode& ch = t.nodes[k];
+            m  += ch.m;
+            mx += ch.m * ch.cx;
+            my += ch.m * ch.cy;
+            mz += ch.m * ch.cz;
+        }
+    }
+
+    const float inv_m = m > 0.0f ? 1.0f / m : 0.0f;
+    n.m  = m;
+    n.cx = m > 0.0f ? mx * inv_m : cx;
+    n.cy = m > 0.0f ? my * inv_m : cy;
+    n.cz = m > 0.0f ? mz * inv_m : cz;
+
+    const float ox = n.cx - cx, oy = n.cy - cy, oz = n.cz - cz;
+    const float delta  = sqrtf(ox * ox + oy * oy + oz * oz);
+    const float r_open = 2.0f * half / prm.theta + delta;
+    n.open2 = r_open * r_open;
+}
+
+// Bounding cube of the first n particles: corner lo and edge length, padded
+// so every particle quantises strictly inside the key grid.
+static float bh_bounds(const ParticlesSoA& p, int n, float lo_out[3]) {
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    #pragma omp parallel for reduction(min: lo[:3]) reduction(max: hi[:3])
+    for (int i = 0; i < n; ++i) {
+        lo[0] = std::min(lo[0], p.x[i]); hi[0] = std::max(hi[0], p.x[i]);
+        lo[1] = std::min(lo[1], p.y[i]); hi[1] = std::max(hi[1], p.y[i]);
+        lo[2] = std::min(lo[2], p.z[i]); hi[2] = std::max(hi[2], p.z[i]);
+    }
+    float size = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    for (int a = 0; a < 3; ++a) lo_out[a] = lo[a];
+    return size * 1.0001f + 1e-6f;
+}
+
+// Build the octree over the first n particles of p.
+static inline void bh_build(BHTree& t, const ParticlesSoA& p, int n, const BHParams& prm) {
+    const float size = bh_bounds(p, n, t.lo);
+    t.size = size;
+
+    const float inv_size = 1.0f / size;
+    t.sorted.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        t.sorted[i].key   = bh_morton(p.x[i], p.y[i], p.z[i], t.lo, inv_size);
+        t.sorted[i].index = (uint32_t)i;
+    }
+    radix_sort_by_key(t.sorted, t.scratch, 3 * BH_KEY_LEVELS);
+
+    t.px.resize(n); t.py.resize(n); t.pz.resize(n); t.pm.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = t.sorted[k].index;
+        t.px[k] = p.x[i]; t.py[k] = p.y[i]; t.pz[k] = p.z[i]; t.pm[k] = p.mass[i];
+    }
+
+    t.nodes.resize((size_t)2 * n + 1);
+    t.n_nodes.store(1);
+    const float half = 0.5f * size;
+    #pragma omp parallel
+    #pragma omp single
+    bh_build_node(t, prm, 0, 0, (uint32_t)n, 0,
+                  t.lo[0] + half, t.lo[1] + half, t.lo[2] + half, half);
+}
+
+// Gravitational acceleration on every particle, written in original particle
+// order. Returns the number of particle-particle plus particle-node
+// interactions evaluated. With an active mask (indexed by original particle),
+// only particles with a non-zero entry are updated; the rest keep their
+// previous accelerations.
+static inline uint64_t bh_accelerations(const BHTree& t, const BHParams& prm,
+                                        float* ax, float* ay, float* az,
+                                        const uint8_t* active = nullptr) {
+    const int   n    = (int)t.sorted.size();
+    const float eps2 = prm.softening * prm.softening;
+    uint64_t interactions = 0;
+
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+: interactions)
+    for (int j = 0; j < n; ++j) {
+        const uint32_t i = t.sorted[j].index;
+        if (active && !active[i]) continue;
+        const float xi = t.px[j], yi = t.py[j], zi = t.pz[j];
+        float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+        uint64_t count = 0;
+
+        uint32_t stack[8 * BH_KEY_LEVELS + 8];
+        int sp = 0;
+        stack[sp++] = 0;
+        while (sp > 0) {
+            const BHNode& nd = t.nodes[stack[--sp]];
+            const float dx = nd.cx - xi, dy = nd.cy - yi, dz = nd.cz - zi;
+            const float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 > nd.open2) {
+                const float inv = 1.0f / sqrtf(d2 + eps2);
+                const float s   = nd.m * inv * inv * inv;
+                sx += s * dx; sy += s * dy; sz += s * dz;
+                ++count;
+            } else if (nd.child == 0) {
+                for (uint32_t k = nd.begin; k < nd.end; ++k) {
+                    const float ex = t.px[k] - xi, ey = t.py[k] - yi, ez = t.pz[k] - zi;
+                    const float inv = 1.0f / sqrtf(ex * ex + ey * ey + ez * ez + eps2);
+                    const float s   = t.pm[k] * inv * inv * inv;
+                    sx += s * ex; sy += s * ey; sz += s * ez;
+                }
+                count += nd.end - nd.begin;
+            } else {
+                for (uint32_t c = 0; c < nd.n_child; ++c) stack[sp++] = nd.child + c;
+            }
+        }
+
+        ax[i] = prm.G * sx;
+        ay[i] = prm.G * sy;
+        az[i] = prm.G * sz;
+        interactions += count;
+    }
+    return interactions;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "particles_soa.h"
+
+// ----------------------------------------------------------------------------
+// Uniform-grid cell list for short-range neighbour search.
+//
+// Build (parallel counting sort, O(N)):
+//   1. bounding box, cell edge >= search radius, so every neighbour of a
+//      particle lies in its own cell or one of the 26 around it,
+//   2. cell id per particle and an atomic count per cell,
+//   3. exclusive scan of the counts -> cell_start,
+//   4. scatter particle indices to their cell's slots (atomic cursors), then
+//      sort each cell's few indices, so the result is deterministic,
+//   5. gather x/y/z into cell order.
+//
+// Cells are numbered x-fastest, so the three cells at (ix-1..ix+1, iy, iz)
+// are one contiguous slot range. A neighbour query is therefore 9 contiguous
+// runs over px/py/pz, and the inner loops vectorise.
+//
+// The grid is capped at CELL_LIST_MAX_CELLS_PER_PARTICLE cells per particle.
+// A thin disk with a tiny radius would otherwise allocate mostly empty
+// cells; past the cap the cell edge grows, which only adds candidates.
+// ----------------------------------------------------------------------------
+
+static const int CELL_LIST_MAX_CELLS_PER_PARTICLE = 8;
+
+struct CellList {
+    float                 lo[3];
+    float                 cell;          // cell edge length (>= radius)
+    float                 inv_cell;
+    int                   dims[3];
+    std::vector<uint32_t> cell_start;    // [c, c + 1) slot range of cell c
+    std::vector<uint32_t> index;         // original particle index per slot
+    std::vector<uint32_t> cell_of;       // cell id per original particle
+    std::vector<float>    px, py, pz;    // positions in slot order
+    std::vector<std::atomic<uint32_t>> cursor;
+};
+
+static inline int cell_list_coord(const CellList& cl, float v, int a) {
+    int c = (int)((v - cl.lo[a]) * cl.inv_cell);
+    return c < 0 ? 0 : (c >= cl.dims[a] ? cl.dims[a] - 1 : c);
+}
+
+// Build the cell list over the first n particles for search radius r.
+static void cell_list_build(CellList& cl, const ParticlesSoA& p, int n, float radius) {
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    #pragma omp parallel for reduction(min: lo[:3]) reduction(max: hi[:3])
+    for (int i = 0; i < n; ++i) {
+        lo[0] = std::min(lo[0], p.x[i]); hi[0] = std::max(hi[0], p.x[i]);
+        lo[1] = std::min(lo[1], p.y[i]); hi[1] = std::max(hi[1], p.y[i]);
+        lo[2] = std::min(lo[2], p.z[i]); hi[2] = std::max(hi[2], p.z[i]);
+    }
+
+    const double max_cells = (double)CELL_LIST_MAX_CELLS_PER_PARTICLE * std::max(n, 1);
+    float cell = radius;
+    for (;;) {
+        double cells = 1.0;
+        for (int a = 0; a < 3; ++a) cells *= floor((hi[a] - lo[a]) / cell) + 1.0;
+        if (cells <= max_cells) break;
+        cell *= 1.25f;
+    }
+    cl.cell     = cell;
+    cl.inv_cell = 1.0f / cell;
+    for (int a = 0; a < 3; ++a) {
+        cl.lo[a]   = lo[a];
+        cl.dims[a] = (int)floorf((hi[a] - lo[a]) * cl.inv_cell) + 1;
+    }
+    const size_t n_cells = (size_t)cl.dims[0] * cl.dims[1] * cl.dims[2];
+
+    if (cl.cursor.size() != n_cells) std::vector<std::atomic<uint32_t>>(n_cells).swap(cl.cursor);
+    cl.cell_of.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (size_t c = 0; c < n_cells; ++c) cl.cursor[c].store(0, std::memory_order_relaxed);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        const int ix = cell_list_coord(cl, p.x[i], 0);
+        const int iy = cell_list_coord(cl, p.y[i], 1);
+        const int iz = cell_list_coord(cl, p.z[i], 2);
+        const uint32_t c = (uint32_t)((iz * cl.dims[1] + iy) * cl.dims[0] + ix);
+        cl.cell_of[i] = c;
+        cl.cursor[c].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    cl.cell_start.resize(n_cells + 1);
+    uint32_t sum = 0;
+    for (size_t c = 0; c < n_cells; ++c) {
+        const uint32_t count = cl.cursor[c].load(std::memory_order_relaxed);
+        cl.cell_start[c] = sum;
+        cl.cursor[c].store(sum, std::memory_order_relaxed);
+        sum += count;
+    }
+    cl.cell_start[n_cells] = sum;
+
+    cl.index.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i)
+        cl.index[cl.cursor[cl.cell_of[i]].fetch_add(1, std::memory_order_relaxed)] = (uint32_t)i;
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t c = 0; c < n_cells; ++c)
+        std::sort(cl.index.begin() + cl.cell_start[c], cl.index.begin() + cl.cell_start[c + 1]);
+
+    cl.px.resize(n); cl.py.resize(n); cl.pz.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = cl.index[k];
+        cl.px[k] = p.x[i]; cl.py[k] = p.y[i]; cl.pz[k] = p.z[i];
+    }
+}
+
+static inline size_t cell_list_cells(const CellList& cl) {
+    return (size_t)cl.dims[0] * cl.dims[1] * cl.dims[2];
+}
+
+// Call f(begin, end) for each of the (up to 9) contiguous slot ranges that
+// together cover cell c and its 26 neighbours.
+template <typename F>
+static inline void cell_list_for_each_range(const CellList& cl, size_t c, F&& f) {
+    const int ix = (int)(c % cl.dims[0]);
+    const int iy = (int)(c / cl.dims[0] % cl.dims[1]);
+    const int iz = (int)(c / ((size_t)cl.dims[0] * cl.dims[1]));
+    const int x0 = std::max(ix - 1, 0), x1 = std::min(ix + 1, cl.dims[0] - 1);
+    for (int z = std::max(iz - 1, 0); z <= std::min(iz + 1, cl.dims[2] - 1); ++z)
+        for (int y = std::max(iy - 1, 0); y <= std::min(iy + 1, cl.dims[1] - 1); ++y) {
+            const size_t row = ((size_t)z * cl.dims[1] + y) * cl.dims[0];
+            const uint32_t b = cl.cell_start[row + x0];
+            const uint32_t e = cl.cell_start[row + x1 + 1];
+            if (b < e) f(b, e);
+        }
+}
+
+// The ranges of cell_list_for_each_range collected into rb/re (9 entries
+// each); returns how many there are. Per-cell loops fetch them once and reuse
+// them for every particle in the cell.
+static inline int cell_list_ranges(const CellList& cl, size_t c, uint32_t rb[9], uint32_t re[9]) {
+    int n = 0;
+    cell_list_for_each_range(cl, c, [&](uint32_t b, uint32_t e) {
+        rb[n] = b;
+        re[n] = e;
+        ++n;
+    });
+    return n;
+}
+
+// Call f(j, dx, dy, dz, r2) for every slot j != k within radius of slot k,
+// with d = x_j - x_k.
+template <typename F>
+static inline void cell_list_for_each_neighbour(const CellList& cl, uint32_t k, float radius, F&& f) {
+    const float  r2 = radius * radius;
+    const float  xk = cl.px[k], yk = cl.py[k], zk = cl.pz[k];
+    const size_t c  = cl.cell_of[cl.index[k]];
+    cell_list_for_each_range(cl, c, [&](uint32_t b, uint32_t e) {
+        for (uint32_t j = b; j < e; ++j) {
+            const float dx = cl.px[j] - xk, dy = cl.py[j] - yk, dz = cl.pz[j] - zk;
+            const float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 < r2 && j != k) f(j, dx, dy, dz, d2);
+        }
+    });
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+// Checkpoint / restart for the galaxy simulation.
+//
+// A checkpoint is the particle arrays exactly as they sit in memory, one
+// page-aligned block per field, behind a one-page header:
+//
+//   offset 0      CheckpointHeader + CheckpointFieldDesc[n_fields]   (4096 bytes)
+//   field k       raw bytes of field k, starting on a page boundary
+//
+// For SoA every array (x, y, ..., spin_z) is its own field, so the file can
+// be mmap'ed and each block copied straight back into its std::vector. AoS
+// stores the whole ParticleAoS array as a single field. Restart is therefore
+// one sequential read of the state with no per-particle parsing.
+//
+// Writes are atomic: the checkpoint goes to "<path>.tmp", is fsync'ed and then
+// renamed over <path>, so a crash mid-write leaves the previous checkpoint
+// intact.
+// ----------------------------------------------------------------------------
+
+static const char     CHECKPOINT_MAGIC[8]      = { 'G', 'A', 'L', 'C', 'K', 'P', 'T', '\0' };
+static const uint32_t CHECKPOINT_VERSION       = 1;
+static const uint32_t CHECKPOINT_ALIGN         = 4096;
+static const uint32_t CHECKPOINT_MAX_FIELDS    = 64;
+static const uint32_t CHECKPOINT_LAYOUT_AOS    = 1;
+static const uint32_t CHECKPOINT_LAYOUT_SOA    = 2;
+static const uint32_t CHECKPOINT_LAYOUT_STREAM = 3;  // out-of-core store (particle_stream.h)
+static const uint32_t CHECKPOINT_FLAG_DIRTY    = 1;  // a stream pass was in progress
+
+struct CheckpointHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t layout;          // CHECKPOINT_LAYOUT_*
+    uint64_t n_particles;
+    int64_t  iteration;       // completed simulation steps
+    uint64_t rng_state;       // counter-RNG seed the particles were initialised from
+    uint32_t n_fields;
+    uint32_t flags;           // CHECKPOINT_FLAG_*
+    uint32_t reserved[4];
+};
+
+struct CheckpointFieldDesc {
+    char     name[24];
+    uint64_t offset;          // page-aligned byte offset of the field data
+    uint64_t bytes;
+};
+
+static_assert(sizeof(CheckpointHeader)    == 64, "checkpoint header must be 64 bytes");
+static_assert(sizeof(CheckpointFieldDesc) == 40, "checkpoint field descriptor must be 40 bytes");
+static_assert(sizeof(CheckpointHeader) + CHECKPOINT_MAX_FIELDS * sizeof(CheckpointFieldDesc)
+                  <= CHECKPOINT_ALIGN, "checkpoint header must fit in one page");
+
+// One in-memory array to save or restore.
+struct CheckpointField {
+    const char* name;
+    void*       data;
+    uint64_t    bytes;
+};
+
+static uint64_t checkpoint_align_up(uint64_t v) {
+    return (v + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+static bool checkpoint_write_all(int fd, const void* src, uint64_t n, uint64_t off) {
+    const char* p = static_cast<const char*>(src);
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, (size_t)n, (off_t)off);
+        if (w <= 0) return false;
+        p += w; n -= (uint64_t)w; off += (uint64_t)w;
+    }
+    return true;
+}
+
+static bool checkpoint_save(const char* path, uint32_t layout, uint64_t n_particles,
+                            int64_t iteration, uint64_t rng_state,
+                            const CheckpointField* fields, uint32_t n_fields) {
+    if (n_fields > CHECKPOINT_MAX_FIELDS) return false;
+
+    std::vector<char> head(CHECKPOINT_ALIGN, 0);
+    CheckpointHeader* h = reinterpret_cast<CheckpointHeader*>(head.data());
+    CheckpointFieldDesc* desc = reinterpret_cast<CheckpointFieldDesc*>(h + 1);
+    memcpy(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic));
+    h->version     = CHECKPOINT_VERSION;
+    h->layout      = layout;
+    h->n_particles = n_particles;
+    h->iteration   = iteration;
+    h->rng_state   = rng_state;
+    h->n_fields    = n_fields;
+
+    uint64_t off = CHECKPOINT_ALIGN;
+    for (uint32_t k = 0; k < n_fields; ++k) {
+        strncpy(desc[k].name, fields[k].name, sizeof(desc[k].name) - 1);
+        desc[k].offset = off;
+        desc[k].bytes  = fields[k].bytes;
+        off = checkpoint_align_up(off + fields[k].bytes);
+    }
+
+    const std::string tmp = std::string(path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "checkpoint: cannot create %s\n", tmp.c_str());
+        return false;
+    }
+    bool ok = checkpoint_write_all(fd, head.data(), head.size(), 0);
+    for (uint32_t k = 0; ok && k < n_fields; ++k)
+        ok = checkpoint_write_all(fd, fields[k].data, fields[k].bytes, desc[k].offset);
+    ok = ok && ftruncate(fd, (off_t)off) == 0 && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        fprintf(stderr, "checkpoint: failed to write %s\n", path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Restore into pre-sized arrays. The file must have been written with the
+// same layout, particle count and field list; anything else is rejected.
+static bool checkpoint_load(const char* path, uint32_t layout, uint64_t n_particles,
+                            int64_t& iteration, uint64_t& rng_state,
+                            const CheckpointField* fields, uint32_t n_fields) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "checkpoint: cannot open %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < CHECKPOINT_ALIGN) {
+        fprintf(stderr, "checkpoint: %s is truncated\n", path);
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "checkpoint: cannot map %s\n", path);
+        return false;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const char* base = static_cast<const char*>(map);
+    const CheckpointHeader* h = reinterpret_cast<const CheckpointHeader*>(base);
+    const CheckpointFieldDesc* desc = reinterpret_cast<const CheckpointFieldDesc*>(h + 1);
+
+    bool ok = memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) == 0 &&
+              h->version == CHECKPOINT_VERSION && h->layout == layout &&
+              h->n_particles == n_particles && h->n_fields == n_fields;
+    for (uint32_t k = 0; ok && k < n_fields; ++k) {
+        ok = strncmp(desc[k].name, fields[k].name, sizeof(desc[k].name)) == 0 &&
+             desc[k].bytes == fields[k].bytes &&
+             desc[k].offset + desc[k].bytes <= (uint64_t)st.st_size;
+    }
+    if (ok) {
+        for (uint32_t k = 0; k < n_fields; ++k)
+            memcpy(fields[k].data, base + desc[k].offset, fields[k].bytes);
+        iteration = h->iteration;
+        rng_state = h->rng_state;
+    } else {
+        fprintf(stderr, "checkpoint: %s does not match this run\n", path);
+    }
+    munmap(map, (size_t)st.st_size);
+    return ok;
+}
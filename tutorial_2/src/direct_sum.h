@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "particles_soa.h"
+
+// O(N^2) softened gravity — the reference the tree solvers are measured
+// against. Only practical for small N (tens of thousands of particles).
+// The inner loop is a plain reduction over contiguous arrays so it vectorises.
+static uint64_t direct_accelerations(const ParticlesSoA& p, int n, float G, float softening,
+                                     float* ax, float* ay, float* az) {
+    const float  eps2 = softening * softening;
+    const float* px = p.x.data();
+    const float* py = p.y.data();
+    const float* pz = p.z.data();
+    const float* pm = p.mass.data();
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < n; ++i) {
+        const float xi = px[i], yi = py[i], zi = pz[i];
+        float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+        #pragma omp simd reduction(+: sx, sy, sz)
+        for (int j = 0; j < n; ++j) {
+            const float dx = px[j] - xi, dy = py[j] - yi, dz = pz[j] - zi;
+            const float inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + eps2);
+            const float s   = pm[j] * inv * inv * inv;
+            sx += s * dx; sy += s * dy; sz += s * dz;
+        }
+        ax[i] = G * sx;
+        ay[i] = G * sy;
+        az[i] = G * sz;
+    }
+    return (uint64_t)n * (uint64_t)n;
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "barnes_hut.h"
+
+// ----------------------------------------------------------------------------
+// Fast multipole method over the SoA particle arrays.
+//
+// The octree is the Barnes–Hut tree (barnes_hut.h): Morton-ordered particles,
+// contiguous particle ranges per node, expansions centred on each node's
+// centre of mass. On top of it this file adds Cartesian Taylor expansions of
+// 1/r up to a configurable order p (terms with total degree <= p):
+//
+//   P2M  M_k  = sum_j m_j y_j^k / k!                    (y = x_j - centre)
+//   M2M  M'_k = sum_{l<=k} M_l d^(k-l) / (k-l)!
+//   M2L  L_n  = 1/n! sum_k (-1)^|k| M_k D_(n+k)(R)      (|n| + |k| <= p)
+//   L2L  L'_n = sum_{m>=n} L_m m! / (n! (m-n)!) d^(m-n)
+//   L2P  a    = G grad( sum_n L_n z^n )
+//   P2P  softened direct sum between leaves
+//
+// D_n(R) = d^n/dR^n (1/|R|) comes from the McMurchie–Davidson recurrence
+//   R^(j)_0      = (-1)^j (2j-1)!! / r^(2j+1)
+//   R^(j)_(n+e)  = R_e R^(j+1)_n + n_e R^(j+1)_(n-e),   D_n = R^(0)_n
+// The recurrence holds for any function of r^2, so the Plummer-softened
+// kernel 1/sqrt(r^2 + eps^2) costs nothing extra: r^2 becomes r^2 + eps^2 in
+// R^(j)_0 only. Far and near field then use the same force law as the direct
+// sum and Barnes–Hut, and there is no softening error floor.
+//
+// Interactions are found by a dual tree traversal: a (target, source) node
+// pair is well separated when r_T + r_S < theta * |c_T - c_S| (r = max
+// particle distance from the centre). Splitting a large target node spawns
+// OpenMP tasks for its children; each task only writes to its own target
+// subtree, so no locking is needed.
+//
+// Far-field force error falls roughly as theta^p, so order is the
+// accuracy/time knob. The force needs |n| >= 1, so p >= 1.
+// ----------------------------------------------------------------------------
+
+static const int FMM_MAX_ORDER   = 12;
+static const int FMM_TASK_CUTOFF = 8192;   // target subtrees smaller than this run inline
+
+struct FMMParams {
+    int   order     = 4;      // expansion order p
+    float theta     = 0.5f;   // multipole acceptance: smaller is more accurate
+    float softening = 0.05f;  // Plummer softening length
+    float G         = 1.0f;
+    int   leaf_size = 64;     // larger than Barnes–Hut: P2P between leaves is cheap
+};
+
+// Multi-index bookkeeping for one expansion order. Terms are sorted by total
+// degree, so "all terms of degree <= d" is the prefix [0, n_upto[d]).
+struct FMMTables {
+    int p       = -1;
+    int n_terms = 0;
+    std::vector<int>    ix, iy, iz, deg;
+    std::vector<int>    n_upto;       // [d] number of terms with degree <= d
+    std::vector<int>    parent;       // term minus e_axis (recurrence predecessor)
+    std::vector<int>    axis;         // axis removed to reach parent
+    std::vector<int>    grand;        // parent minus e_axis, or -1
+    std::vector<int>    up[3];        // term plus e_axis, or -1 beyond order p
+    std::vector<double> inv_fact;     // 1 / (ix! iy! iz!)
+    std::vector<int>    sum_index;    // [n * n_terms + k] -> term n + k, or -1
+
+    // (k, l, k - l) for all l <= k componentwise; shared by M2M and L2L.
+    struct Shift { int k, l, kl; double coef; };   // coef = k! / l! (L2L only)
+    std::vector<Shift>  shifts;
+    std::vector<int>    lut;          // (a, b, c) -> term
+
+    int lookup(int a, int b, int c) const {
+        if (a < 0 || b < 0 || c < 0 || a + b + c > p) return -1;
+        return lut[(a * (p + 1) + b) * (p + 1) + c];
+    }
+
+    void init(int order) {
+        p = order;
+        lut.assign((size_t)(p + 1) * (p + 1) * (p + 1), -1);
+        ix.clear(); iy.clear(); iz.clear(); deg.clear(); n_upto.clear();
+        for (int d = 0; d <= p; ++d) {
+            for (int a = d; a >= 0; --a)
+                for (int b = d - a; b >= 0; --b) {
+                    int c = d - a - b;
+                    lut[(a * (p + 1) + b) * (p + 1) + c] = (int)ix.size();
+                    ix.push_back(a); iy.push_back(b); iz.push_back(c); deg.push_back(d);
+                }
+            n_upto.push_back((int)ix.size());
+        }
+        n_terms = (int)ix.size();
+
+        std::vector<double> fact(p + 1, 1.0);
+        for (int i = 1; i <= p; ++i) fact[i] = fact[i - 1] * i;
+
+        parent.assign(n_terms, -1); axis.assign(n_terms, -1); grand.assign(n_terms, -1);
+        inv_fact.assign(n_terms, 1.0);
+        for (int a = 0; a < 3; ++a) up[a].assign(n_terms, -1);
+        for (int t = 0; t < n_terms; ++t) {
+            int n[3] = { ix[t], iy[t], iz[t] };
+            inv_fact[t] = 1.0 / (fact[n[0]] * fact[n[1]] * fact[n[2]]);
+            for (int a = 0; a < 3; ++a) {
+                int m[3] = { n[0], n[1], n[2] };
+                ++m[a];
+                up[a][t] = lookup(m[0], m[1], m[2]);
+            }
+            if (t == 0) continue;
+            int a = n[0] > 0 ? 0 : (n[1] > 0 ? 1 : 2);
+            int m[3] = { n[0], n[1], n[2] };
+            --m[a];
+            axis[t]   = a;
+            parent[t] = lookup(m[0], m[1], m[2]);
+            --m[a];
+            grand[t]  = lookup(m[0], m[1], m[2]);
+        }
+
+        sum_index.assign((size_t)n_terms * n_terms, -1);
+        shifts.clear();
+        for (int n = 0; n < n_terms; ++n)
+            for (int k = 0; k < n_terms; ++k) {
+                sum_index[(size_t)n * n_terms + k] =
+                    lookup(ix[n] + ix[k], iy[n] + iy[k], iz[n] + iz[k]);
+                int kl = lookup(ix[n] - ix[k], iy[n] - iy[k], iz[n] - iz[k]);
+                if (kl >= 0) {
+                    Shift s = { n, k, kl, inv_fact[k] / inv_fact[n] };
+                    shifts.push_back(s);
+                }
+            }
+    }
+};
+
+struct FMMSolver {
+    FMMParams             prm;
+    FMMTables             tab;
+    BHTree                tree;
+    std::vector<double>   M, L;           // [node * n_terms + term]
+    std::vector<float>    rmax;           // [node] max particle distance from centre
+    std::vector<float>    sax, say, saz;  // accelerations in Morton order (before G)
+    std::atomic<uint64_t> n_p2p, n_m2l;
+};
+
+struct FMMStats {
+    uint64_t p2p_pairs;   // particle-particle interactions in the near field
+    uint64_t m2l;         // multipole-to-local translations
+};
+
+// y^n / n! for every term (factorial-scaled monomials).
+static inline void fmm_scaled_powers(const FMMTables& tab, double x, double y, double z,
+                                     double* pw) {
+    const double v[3] = { x, y, z };
+    pw[0] = 1.0;
+    for (int t = 1; t < tab.n_terms; ++t) {
+        const int a  = tab.axis[t];
+        const int na = a == 0 ? tab.ix[t] : (a == 1 ? tab.iy[t] : tab.iz[t]);
+        pw[t] = pw[tab.parent[t]] * v[a] / na;
+    }
+}
+
+// D_n(R) = d^n/dR^n (1/sqrt(|R|^2 + eps2)) for every term, via the recurrence
+// above. work must hold (p + 1) * n_terms doubles.
+static inline void fmm_derivatives(const FMMTables& tab, double rx, double ry, double rz,
+                                   double eps2, double* D, double* work) {
+    const int    p = tab.p, T = tab.n_terms;
+    const double r[3]   = { rx, ry, rz };
+    const double inv_r2 = 1.0 / (rx * rx + ry * ry + rz * rz + eps2);
+    double*      R      = work;   // R[j * T + t] = R^(j)_t
+
+    R[0] = sqrt(inv_r2);
+    for (int j = 0; j < p; ++j) R[(j + 1) * T] = -(2 * j + 1) * inv_r2 * R[j * T];
+
+    for (int t = 1; t < T; ++t) {
+        const int a  = tab.axis[t];
+        const int pt = tab.parent[t];
+        const int gt = tab.grand[t];
+        const int na = (a == 0 ? tab.ix[pt] : (a == 1 ? tab.iy[pt] : tab.iz[pt]));
+        for (int j = 0; j <= p - tab.deg[t]; ++j) {
+            double v = r[a] * R[(j + 1) * T + pt];
+            if (gt >= 0) v += na * R[(j + 1) * T + gt];
+            R[j * T + t] = v;
+        }
+    }
+    for (int t = 0; t < T; ++t) D[t] = R[t];
+}
+
+static void fmm_upward(FMMSolver& s, uint32_t ni) {
+    const BHNode&    nd  = s.tree.nodes[ni];
+    const FMMTables& tab = s.tab;
+    const int        T   = tab.n_terms;
+    double*          M   = &s.M[(size_t)ni * T];
+    for (int t = 0; t < T; ++t) M[t] = 0.0;
+
+    std::vector<double> pw(T);
+    float r = 0.0f;
+    if (nd.child == 0) {
+        for (uint32_t k = nd.begin; k < nd.end; ++k) {
+            const double dx = s.tree.px[k] - nd.cx;
+            const double dy = s.tree.py[k] - nd.cy;
+            const double dz = s.tree.pz[k] - nd.cz;
+            fmm_scaled_powers(tab, dx, dy, dz, pw.data());
+            const double m = s.tree.pm[k];
+            for (int t = 0; t < T; ++t) M[t] += m * pw[t];
+            r = std::max(r, (float)sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    } else {
+        for (uint32_t c = nd.child; c < nd.child + nd.n_child; ++c) {
+            if (s.tree.nodes[c].end - s.tree.nodes[c].begin > (uint32_t)FMM_TASK_CUTOFF) {
+                FMMSolver* sp = &s;
+                #pragma omp task firstprivate(sp, c)
+                fmm_upward(*sp, c);
+            } else {
+                fmm_upward(s, c);
+            }
+        }
+        #pragma omp taskwait
+        for (uint32_t c = nd.child; c < nd.child + nd.n_child; ++c) {
+            const BHNode& ch = s.tree.nodes[c];
+            const double dx = ch.cx - nd.cx, dy = ch.cy - nd.cy, dz = ch.cz - nd.cz;
+            fmm_scaled_powers(tab, dx, dy, dz, pw.data());
+            const double* Mc = &s.M[(size_t)c * T];
+            for (size_t q = 0; q < tab.shifts.size(); ++q) {
+                const FMMTables::Shift& sh = tab.shifts[q];
+                M[sh.k] += Mc[sh.l] * pw[sh.kl];
+            }
+            const float d = (float)sqrt(dx * dx + dy * dy + dz * dz);
+            r = std::max(r, d + s.rmax[c]);
+        }
+    }
+    s.rmax[ni] = r;
+}
+
+// Multipole of source node sj translated into the local expansion of ti.
+static inline void fmm_m2l(FMMSolver& s, uint32_t ti, uint32_t sj,
+                           double* D, double* sM, double* work) {
+    const FMMTables& tab = s.tab;
+    const int        T   = tab.n_terms;
+    const BHNode&    tn  = s.tree.nodes[ti];
+    const BHNode&    sn  = s.tree.nodes[sj];
+    fmm_derivatives(tab, (double)tn.cx - sn.cx, (double)tn.cy - sn.cy, (double)tn.cz - sn.cz,
+                    (double)s.prm.softening * s.prm.softening, D, work);
+    const double* Ms = &s.M[(size_t)sj * T];
+    for (int k = 0; k < T; ++k) sM[k] = (tab.deg[k] & 1) ? -Ms[k] : Ms[k];
+
+    double* Lt = &s.L[(size_t)ti * T];
+    for (int n = 0; n < T; ++n) {
+        const int  kmax = tab.n_upto[tab.p - tab.deg[n]];
+        const int* nk   = &tab.sum_index[(size_t)n * T];
+        double acc = 0.0;
+        #pragma omp simd reduction(+: acc)
+        for (int k = 0; k < kmax; ++k) acc += sM[k] * D[nk[k]];
+        Lt[n] += tab.inv_fact[n] * acc;
+    }
+    s.n_m2l.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Softened direct sum of source leaf sj onto target leaf ti.
+static inline void fmm_p2p(FMMSolver& s, uint32_t ti, uint32_t sj) {
+    const BHNode& tn   = s.tree.nodes[ti];
+    const BHNode& sn   = s.tree.nodes[sj];
+    const float   eps2 = s.prm.softening * s.prm.softening;
+    const float*  px = s.tree.px.data();
+    const float*  py = s.tree.py.data();
+    const float*  pz = s.tree.pz.data();
+    const float*  pm = s.tree.pm.data();
+    const int     jb = (int)sn.begin, je = (int)sn.end;
+    for (uint32_t i = tn.begin; i < tn.end; ++i) {
+        const float xi = px[i], yi = py[i], zi = pz[i];
+        float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+        #pragma omp simd reduction(+: sx, sy, sz)
+        for (int j = jb; j < je; ++j) {
+            const float dx = px[j] - xi, dy = py[j] - yi, dz = pz[j] - zi;
+            const float inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + eps2);
+            const float w   = pm[j] * inv * inv * inv;
+            sx += w * dx; sy += w * dy; sz += w * dz;
+        }
+        s.sax[i] += sx; s.say[i] += sy; s.saz[i] += sz;
+    }
+    s.n_p2p.fetch_add((uint64_t)(tn.end - tn.begin) * (sn.end - sn.begin),
+                      std::memory_order_relaxed);
+}
+
+static void fmm_dual_walk(FMMSolver& s, uint32_t ti, uint32_t sj,
+                          double* D, double* sM, double* work) {
+    const BHNode& tn = s.tree.nodes[ti];
+    const BHNode& sn = s.tree.nodes[sj];
+    const float dx = tn.cx - sn.cx, dy = tn.cy - sn.cy, dz = tn.cz - sn.cz;
+    const float d2 = dx * dx + dy * dy + dz * dz;
+    const float rs = s.rmax[ti] + s.rmax[sj];
+
+    if (ti != sj && rs * rs < s.prm.theta * s.prm.theta * d2) {
+        fmm_m2l(s, ti, sj, D, sM, work);
+        return;
+    }
+    const bool t_leaf = tn.child == 0, s_leaf = sn.child == 0;
+    if (t_leaf && s_leaf) {
+        fmm_p2p(s, ti, sj);
+        return;
+    }
+    if (s_leaf || (!t_leaf && s.rmax[ti] >= s.rmax[sj])) {
+        // Split the target. Children own disjoint outputs, so big ones run as
+        // tasks; wait before returning so the caller's next source pair never
+        // overlaps with these writes.
+        if (tn.end - tn.begin > (uint32_t)FMM_TASK_CUTOFF) {
+            for (uint32_t c = tn.child; c < tn.child + tn.n_child; ++c) {
+                FMMSolver* sp = &s;
+                #pragma omp task firstprivate(sp, c, sj)
+                {
+                    const int T = sp->tab.n_terms;
+                    std::vector<double> buf((size_t)(sp->tab.p + 4) * T);
+                    fmm_dual_walk(*sp, c, sj, buf.data(), buf.data() + T, buf.data() + 2 * T);
+                }
+            }
+            #pragma omp taskwait
+        } else {
+            for (uint32_t c = tn.child; c < tn.child + tn.n_child; ++c)
+                fmm_dual_walk(s, c, sj, D, sM, work);
+        }
+    } else {
+        for (uint32_t c = sn.child; c < sn.child + sn.n_child; ++c)
+            fmm_dual_walk(s, ti, c, D, sM, work);
+    }
+}
+
+static void fmm_downward(FMMSolver& s, uint32_t ni) {
+    const BHNode&    nd  = s.tree.nodes[ni];
+    const FMMTables& tab = s.tab;
+    const int        T   = tab.n_terms;
+    const double*    L   = &s.L[(size_t)ni * T];
+    std::vector<double> pw(T);
+
+    if (nd.child == 0) {
+        // L2P: gradient of sum_n L_n z^n, using unscaled powers z^n.
+        for (uint32_t k = nd.begin; k < nd.end; ++k) {
+            const double z[3] = { s.tree.px[k] - nd.cx, s.tree.py[k] - nd.cy,
+                                  s.tree.pz[k] - nd.cz };
+            pw[0] = 1.0;
+            for (int t = 1; t < T; ++t) pw[t] = pw[tab.parent[t]] * z[tab.axis[t]];
+            double g[3] = { 0.0, 0.0, 0.0 };
+            for (int t = 0; t < tab.n_upto[tab.p - 1]; ++t) {
+                const int n[3] = { tab.ix[t], tab.iy[t], tab.iz[t] };
+                for (int a = 0; a < 3; ++a)
+                    g[a] += L[tab.up[a][t]] * (n[a] + 1) * pw[t];
+            }
+            s.sax[k] += (float)g[0];
+            s.say[k] += (float)g[1];
+            s.saz[k] += (float)g[2];
+        }
+        return;
+    }
+
+    for (uint32_t c = nd.child; c < nd.child + nd.n_child; ++c) {
+        const BHNode& ch = s.tree.nodes[c];
+        const double dx = ch.cx - nd.cx, dy = ch.cy - nd.cy, dz = ch.cz - nd.cz;
+        fmm_scaled_powers(tab, dx, dy, dz, pw.data());
+        double* Lc = &s.L[(size_t)c * T];
+        for (size_t q = 0; q < tab.shifts.size(); ++q) {
+            const FMMTables::Shift& sh = tab.shifts[q];
+            Lc[sh.l] += L[sh.k] * sh.coef * pw[sh.kl];
+        }
+        if (ch.end - ch.begin > (uint32_t)FMM_TASK_CUTOFF) {
+            FMMSolver* sp = &s;
+            #pragma omp task firstprivate(sp, c)
+            fmm_downward(*sp, c);
+        } else {
+            fmm_downward(s, c);
+        }
+    }
+    #pragma omp taskwait
+}
+
+// Gravitational acceleration on the first n particles of p, written in
+// original particle order.
+static FMMStats fmm_accelerations(FMMSolver& s, const ParticlesSoA& p, int n,
+                                  float* ax, float* ay, float* az) {
+    if (s.tab.p != s.prm.order) s.tab.init(s.prm.order);
+
+    BHParams bp;
+    bp.theta     = s.prm.theta;
+    bp.softening = s.prm.softening;
+    bp.G         = s.prm.G;
+    bp.leaf_size = s.prm.leaf_size;
+    bh_build(s.tree, p, n, bp);
+
+    const size_t n_nodes = s.tree.n_nodes.load();
+    const int    T       = s.tab.n_terms;
+    s.M.assign(n_nodes * T, 0.0);
+    s.L.assign(n_nodes * T, 0.0);
+    s.rmax.assign(n_nodes, 0.0f);
+    s.sax.assign(n, 0.0f); s.say.assign(n, 0.0f); s.saz.assign(n, 0.0f);
+    s.n_p2p.store(0);
+    s.n_m2l.store(0);
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        fmm_upward(s, 0);
+        std::vector<double> buf((size_t)(s.tab.p + 4) * T);
+        fmm_dual_walk(s, 0, 0, buf.data(), buf.data() + T, buf.data() + 2 * T);
+        fmm_downward(s, 0);
+    }
+
+    const float G = s.prm.G;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = s.tree.sorted[k].index;
+        ax[i] = G * s.sax[k];
+        ay[i] = G * s.say[k];
+        az[i] = G * s.saz[k];
+    }
+
+    FMMStats st;
+    st.p2p_pairs = s.n_p2p.load();
+    st.m2l       = s.n_m2l.load();
+    return st;
+}
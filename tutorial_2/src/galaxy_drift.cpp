@@ -0,0 +1,511 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "particle_store.h"
+#include "particle_stream.h"
+#include "particles_half.h"
+#include "particles_soa.h"
+#include "snapshot.h"
+
+// Drift-engine modes for the tutorial_2 galaxy.
+//
+// soa_optimized is kept as the minimal SoA mirror of aos_baseline so the two
+// ATP profiles differ only in data layout. This program runs the same drift
+// (x += v*dt) over the same ParticlesSoA arrays with the options that change
+// how the particles are stored or swept:
+//
+//   --out-of-core PATH    stream the hot fields from a file (particle_stream.h)
+//   --storage fp16|bf16   16-bit velocities, fp16 also positions (particles_half.h)
+//   --temporal-block K    advance cache-sized blocks K steps per pass
+//   --escape-radius R / --spawn K   dynamic store with removal and insertion
+//                         (particle_store.h)
+//
+// Without any of them it is the plain SoA run and prints the same checksum
+// as soa_optimized. --visualize, --checkpoint-every and --resume work as in
+// soa_optimized and write galaxy_drift.bin / galaxy_drift.ckpt.
+//
+// Usage:
+//   ./galaxy_drift [--particles N] [--out-of-core PATH [--chunk M]]
+//                  [--storage fp16 [--half-positions] | --storage bf16]
+//                  [--temporal-block K [--block-particles B] | --temporal-sweep]
+//                  [--escape-radius R] [--spawn K [--lifetime T]]
+
+static void update_positions(ParticlesSoA& p, int n, float dt) {
+    for (int i = 0; i < n; ++i) {
+        p.x[i] += p.vx[i] * dt;
+        p.y[i] += p.vy[i] * dt;
+        p.z[i] += p.vz[i] * dt;
+    }
+}
+
+// Temporal blocking: advance particles [b, b + block) by `steps` steps while
+// they are cache-resident, then move to the next block. Each particle sees
+// exactly the same sequence of float operations as `steps` calls to
+// update_positions, so the result is bit-identical, but the arrays cross the
+// memory hierarchy once per `steps` steps instead of once per step.
+static void update_positions_blocked(ParticlesSoA& p, int n, float dt, int steps, int block) {
+    for (int b0 = 0; b0 < n; b0 += block) {
+        const int b1 = std::min(n, b0 + block);
+        for (int s = 0; s < steps; ++s) {
+            for (int i = b0; i < b1; ++i) {
+                p.x[i] += p.vx[i] * dt;
+                p.y[i] += p.vy[i] * dt;
+                p.z[i] += p.vz[i] * dt;
+            }
+        }
+    }
+}
+
+// Particles per temporal block: the six hot arrays of one block fill half of
+// L2, leaving room for the prefetcher. Falls back to a 1 MB L2 (Graviton2/3)
+// where the size is not reported.
+static int temporal_block_particles() {
+    long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (l2 <= 0) l2 = 1 << 20;
+    return std::max(1024, (int)(l2 / 2 / (6 * sizeof(float))) / 1024 * 1024);
+}
+
+// --temporal-sweep: time the full run for several k and compare with the
+// plain one-sweep-per-step loop. Every k must print the same checksum.
+static int run_temporal_sweep(int n, int iters, float dt, int block) {
+    ParticlesSoA particles;
+    particles.resize(n);
+    static const int ks[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+    printf("temporal blocking: N=%d  %d steps  block %d particles (%d KB)\n", n, iters, block,
+           (int)(block * 6 * sizeof(float) / 1024));
+    printf("%6s %10s %8s %10s  %s\n", "k", "ms/step", "GB/s", "speedup", "checksum");
+    double t_base = 0.0;
+    for (size_t j = 0; j < sizeof(ks) / sizeof(ks[0]); ++j) {
+        init_galaxy(particles, n, GALAXY_SEED);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int iter = 0; iter < iters; iter += ks[j]) {
+            const int steps = std::min(ks[j], iters - iter);
+            if (ks[j] == 1) update_positions(particles, n, dt);
+            else            update_positions_blocked(particles, n, dt, steps, block);
+        }
+        const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (j == 0) t_base = t;
+
+        double checksum = 0.0;
+        for (int i = 0; i < n; ++i)
+            checksum += particles.x[i] + particles.y[i] + particles.z[i];
+        // GB/s counts the traffic of the unblocked loop (24 B in, 12 B out per
+        // particle-step), so it is an effective rate for k > 1.
+        printf("%6d %10.3f %8.2f %9.2fx  %.6f\n", ks[j], t / iters * 1e3,
+               36.0 * n * iters / t * 1e-9, t_base / t, checksum);
+    }
+    return 0;
+}
+
+// The same drift over one chunk of a memory-mapped out-of-core store
+// (particle_stream.h), on raw pointers into the mapped window.
+static void update_chunk(float* x, float* y, float* z,
+                         const float* vx, const float* vy, const float* vz,
+                         int64_t n, float dt) {
+    for (int64_t i = 0; i < n; ++i) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+    }
+}
+
+// --out-of-core PATH: the particles live in a file and are streamed through
+// memory a chunk at a time, so N is bounded by disk space, not RAM. Creates
+// the store unless resuming from it; prints the same checksum as the
+// in-memory run.
+static int run_out_of_core(const char* path, uint64_t n, bool n_given, bool resume,
+                           uint64_t chunk, int iters, float dt) {
+    ParticleStream store;
+    if (resume) {
+        if (!stream_open(store, path, true)) return 1;
+        if (n_given && store.n != n) {
+            fprintf(stderr, "%s holds %llu particles, not %llu\n", path,
+                    (unsigned long long)store.n, (unsigned long long)n);
+            return 1;
+        }
+        if (store.dirty) {
+            fprintf(stderr, "%s was interrupted during pass %lld and is partly advanced; "
+                            "it cannot be resumed\n", path, (long long)store.iteration);
+            return 1;
+        }
+        printf("Resumed %s at iteration %lld\n", path, (long long)store.iteration);
+    } else if (!stream_create(store, path, n, GALAXY_SEED)) {
+        return 1;
+    }
+    stream_set_chunk(store, chunk);
+
+    const double bytes_per_pass = (double)store.n * 6 * sizeof(float) * 2;  // read + write back
+    for (int64_t iter = store.iteration; iter < iters; ++iter) {
+        if (!stream_begin_pass(store)) return 1;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = stream_for_each_chunk(store, [&](uint64_t, uint64_t count,
+                                                   float* x, float* y, float* z,
+                                                   float* vx, float* vy, float* vz) {
+            update_chunk(x, y, z, vx, vy, vz, (int64_t)count, dt);
+        });
+        if (!ok || !stream_set_iteration(store, iter + 1)) return 1;
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("pass %lld  %.2f s  %.2f GB/s\n", (long long)iter, s, bytes_per_pass / s * 1e-9);
+    }
+
+    double checksum = 0.0;
+    store.writable = false;
+    stream_for_each_chunk(store, [&](uint64_t, uint64_t count, float* x, float* y, float* z,
+                                     float*, float*, float*) {
+        for (uint64_t i = 0; i < count; ++i) checksum += x[i] + y[i] + z[i];
+    });
+    stream_close(store);
+
+    printf("SoA checksum: %.6f\n", checksum);
+    return 0;
+}
+
+// --storage fp16|bf16 [--half-positions]: run the same drift twice, once in
+// FP32 and once with 16-bit storage (particles_half.h), and report how far
+// the reduced-precision checksum and positions drift from the FP32 run.
+// update_positions with the same `omp simd` as half_update_range, so the
+// --storage comparison measures the bytes saved rather than vectorisation.
+static void update_positions_simd(ParticlesSoA& p, int n, float dt) {
+    float* x = p.x.data();
+    float* y = p.y.data();
+    float* z = p.z.data();
+    const float* vx = p.vx.data();
+    const float* vy = p.vy.data();
+    const float* vz = p.vz.data();
+    #pragma omp simd
+    for (int i = 0; i < n; ++i) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+    }
+}
+
+static int run_reduced_precision(HalfFormat format, bool half_positions, int n,
+                                 int iters, float dt) {
+    ParticlesSoA particles;
+    particles.resize(n);
+    init_galaxy(particles, n, GALAXY_SEED);
+
+    ParticlesHalf half;
+    half_from_soa(half, particles, n, format, half_positions);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int iter = 0; iter < iters; ++iter)
+        update_positions_simd(particles, n, dt);
+    const double t_fp32 = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    t0 = std::chrono::steady_clock::now();
+    for (int iter = 0; iter < iters; ++iter)
+        half_update_positions(half, dt);
+    const double t_half = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    double checksum = 0.0, checksum_half = 0.0, err2 = 0.0, err_max = 0.0;
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = half.perm[k];
+        float x, y, z;
+        half_position(half, k, x, y, z);
+        checksum      += particles.x[i] + particles.y[i] + particles.z[i];
+        checksum_half += x + y + z;
+        const double dx = x - particles.x[i], dy = y - particles.y[i], dz = z - particles.z[i];
+        const double e2 = dx * dx + dy * dy + dz * dz;
+        err2   += e2;
+        err_max = std::max(err_max, e2);
+    }
+
+    const char* name = format == HALF_FP16 ? "fp16" : "bf16";
+    const int   bytes_fp32 = 12 + 12, bytes_half = half.bytes_per_particle();
+    printf("storage     B/particle   ms/step   GB/s\n");
+    printf("fp32        %10d  %8.3f  %5.2f\n", bytes_fp32, t_fp32 / iters * 1e3,
+           (double)(bytes_fp32 + 12) * n * iters / t_fp32 * 1e-9);
+    printf("%s%-8s %10d  %8.3f  %5.2f   (%.2fx)\n", name, half_positions ? "+pos" : "",
+           bytes_half, t_half / iters * 1e3,
+           (double)(bytes_half + (half_positions ? 6 : 12)) * n * iters / t_half * 1e-9,
+           t_fp32 / t_half);
+    printf("SoA checksum: %.6f\n", checksum);
+    printf("%s checksum: %.6f  drift %.6f (%.3e relative)\n", name, checksum_half,
+           checksum_half - checksum, fabs(checksum_half - checksum) / fabs(checksum));
+    printf("position error: rms %.3e  max %.3e\n", sqrt(err2 / n), sqrt(err_max));
+    return 0;
+}
+
+// --escape-radius R / --spawn K: run the drift on a dynamic store
+// (particle_store.h). After every step, particles beyond R are removed and K
+// new galaxy particles are inserted. With --lifetime T each spawned particle
+// is also removed by its handle T steps after insertion, unless it escaped
+// first. Tombstones are compacted away once they pass a quarter of the
+// slots. The update loop itself is unchanged.
+static int run_dynamic(int n, int iters, float dt, float escape_radius, int spawn,
+                       int lifetime) {
+    ParticleStore store;
+    store.p.resize(n);
+    init_galaxy(store.p, n, GALAXY_SEED);
+    store_init(store, n);
+
+    const float r2_max  = escape_radius > 0.0f ? escape_radius * escape_radius : INFINITY;
+    uint64_t    next    = (uint64_t)n;   // galaxy_particle index of the next new star
+    long        removed = 0, inserted = 0, expired = 0;
+    int         compactions = 0;
+    double      t_update = 0.0, t_store = 0.0;
+
+    // Handles of the last `lifetime` steps of spawns, one row per step.
+    std::vector<ParticleId> born(lifetime > 0 ? (size_t)lifetime * spawn : 0);
+
+    for (int iter = 0; iter < iters; ++iter) {
+        auto t0 = std::chrono::steady_clock::now();
+        update_positions(store.p, store.n, dt);
+        t_update += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        t0 = std::chrono::steady_clock::now();
+        removed += store_remove_if(store, [&](const ParticlesSoA& p, int i) {
+            return p.x[i] * p.x[i] + p.y[i] * p.y[i] + p.z[i] * p.z[i] > r2_max;
+        });
+        ParticleId* row = lifetime > 0 ? &born[(size_t)(iter % lifetime) * spawn] : nullptr;
+        for (int k = 0; k < spawn; ++k) {
+            if (row && iter >= lifetime && store_remove(store, row[k])) ++expired;
+            const ParticleId h = store_insert(store, galaxy_particle(GALAXY_SEED, next++));
+            if (row) row[k] = h;
+        }
+        inserted += spawn;
+        store_commit(store);
+        if (store_maybe_compact(store, 0.25f)) ++compactions;
+        t_store += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    double checksum = 0.0;
+    for (int i = 0; i < store.n; ++i)
+        if (store.alive[i]) checksum += store.p.x[i] + store.p.y[i] + store.p.z[i];
+
+    printf("live %d  slots %d  IDs %zu  removed %ld  expired %ld  inserted %ld  compactions %d\n",
+           store.live(), store.n, store.slot.size(), removed, expired, inserted, compactions);
+    printf("update %.3f ms/step  store maintenance %.3f ms/step\n", t_update / iters * 1e3,
+           t_store / iters * 1e3);
+    printf("Dynamic checksum: %.6f\n", checksum);
+    return 0;
+}
+
+// Every SoA array in a fixed order — the checkpoint stores one block per array.
+static std::vector<CheckpointField> checkpoint_fields(ParticlesSoA& p) {
+    std::vector<ParticlesSoA::Field> arrays = p.fields();
+    std::vector<CheckpointField> fields;
+    for (size_t k = 0; k < arrays.size(); ++k) {
+        CheckpointField f = { arrays[k].name, arrays[k].data->data(),
+                              arrays[k].data->size() * sizeof(float) };
+        fields.push_back(f);
+    }
+    return fields;
+}
+int main(int argc, char* argv[]) {
+    int         N              = 1 << 20; // 1,048,576 particles — same as soa_optimized
+    const int   default_iters  = 200;
+    const int   vis_iters      = 1000;
+    const float dt    = 0.005f;
+
+    bool do_vis     = false;
+    bool compress   = false;  // --compress: quantised delta frames (snapshot_codec.h)
+    int  vis_stride = 16;     // --vis-stride S: keep 1-in-S particles per frame
+
+    // --checkpoint-every K: atomically save full state every K iterations.
+    // --resume: start from the checkpoint instead of init_galaxy.
+    const char* ckpt_path  = "galaxy_drift.ckpt";  // --checkpoint PATH
+    int         ckpt_every = 0;
+    bool        resume     = false;
+
+    // --particles N: particle count. --out-of-core PATH: stream the hot fields
+    // from a file instead of holding them in memory, --chunk M particles at a time.
+    uint64_t    n_arg      = 0;
+    const char* ooc_path   = nullptr;
+    uint64_t    chunk      = 1 << 20;
+
+    // --storage fp16|bf16: compare against FP32 with 16-bit velocities;
+    // --half-positions (fp16 only) stores positions as block offsets as well.
+    const char* storage        = "fp32";
+    bool        half_positions = false;
+
+    // --temporal-block K: advance cache-sized blocks of particles K steps per
+    // pass (--block-particles B overrides the size). --temporal-sweep reports
+    // the speedup for a range of K.
+    int  temporal_k     = 1;
+    int  block_arg      = 0;
+    bool temporal_sweep = false;
+
+    // --escape-radius R: remove particles that drift beyond R. --spawn K:
+    // insert K new particles per step, each removed again after --lifetime T
+    // steps if given. Either one switches to the dynamic store.
+    float escape_radius = 0.0f;
+    int   spawn         = 0;
+    int   lifetime      = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--visualize") == 0) {
+            do_vis = true;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "--vis-stride") == 0 && i + 1 < argc) {
+            vis_stride = atoi(argv[++i]);
+            if (vis_stride < 1) vis_stride = 1;
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            ckpt_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            ckpt_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            n_arg = strtoull(argv[++i], nullptr, 10);
+            if (n_arg == 0) {
+                fprintf(stderr, "--particles must be positive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--out-of-core") == 0 && i + 1 < argc) {
+            ooc_path = argv[++i];
+        } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+            chunk = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc) {
+            storage = argv[++i];
+        } else if (strcmp(argv[i], "--half-positions") == 0) {
+            half_positions = true;
+        } else if (strcmp(argv[i], "--temporal-block") == 0 && i + 1 < argc) {
+            temporal_k = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--block-particles") == 0 && i + 1 < argc) {
+            block_arg = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--temporal-sweep") == 0) {
+            temporal_sweep = true;
+        } else if (strcmp(argv[i], "--escape-radius") == 0 && i + 1 < argc) {
+            escape_radius = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--spawn") == 0 && i + 1 < argc) {
+            spawn = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lifetime") == 0 && i + 1 < argc) {
+            lifetime = std::max(0, atoi(argv[++i]));
+        }
+    }
+    if (strcmp(storage, "fp32") != 0 && strcmp(storage, "fp16") != 0 &&
+        strcmp(storage, "bf16") != 0) {
+        fprintf(stderr, "--storage must be fp32, fp16 or bf16\n");
+        return 1;
+    }
+    const bool reduced = strcmp(storage, "fp32") != 0;
+    if (half_positions && strcmp(storage, "fp16") != 0) {
+        fprintf(stderr, "--half-positions needs --storage fp16 (BF16 offsets are too coarse "
+                        "for one step of motion)\n");
+        return 1;
+    }
+
+    const int iters = do_vis ? vis_iters : default_iters;
+
+    if (ooc_path) {
+        if (do_vis || ckpt_every > 0 || reduced) {
+            fprintf(stderr, "--out-of-core cannot be combined with --visualize, --storage or "
+                            "--checkpoint-every (the store is its own checkpoint)\n");
+            return 1;
+        }
+        return run_out_of_core(ooc_path, n_arg ? n_arg : (uint64_t)N, n_arg != 0, resume,
+                               chunk, iters, dt);
+    }
+    if (n_arg > (uint64_t)INT32_MAX) {
+        fprintf(stderr, "--particles above %d needs --out-of-core\n", INT32_MAX);
+        return 1;
+    }
+    if (n_arg) N = (int)n_arg;
+
+    const int block = block_arg > 0 ? block_arg : temporal_block_particles();
+    if (temporal_sweep) return run_temporal_sweep(N, iters, dt, block);
+
+    if (escape_radius > 0.0f || spawn > 0) {
+        if (do_vis || ckpt_every > 0 || resume || reduced) {
+            fprintf(stderr, "--escape-radius and --spawn cannot be combined with --visualize, "
+                            "--checkpoint-every, --resume or --storage\n");
+            return 1;
+        }
+        return run_dynamic(N, iters, dt, escape_radius, spawn, lifetime);
+    }
+
+    if (reduced) {
+        if (do_vis || ckpt_every > 0 || resume) {
+            fprintf(stderr, "--storage cannot be combined with --visualize, "
+                            "--checkpoint-every or --resume\n");
+            return 1;
+        }
+        return run_reduced_precision(strcmp(storage, "fp16") == 0 ? HALF_FP16 : HALF_BF16,
+                                     half_positions, N, iters, dt);
+    }
+
+    const int vis_interval = 10;
+    const int vis_frames   = 1 + iters / vis_interval;
+
+    ParticlesSoA particles;
+    particles.resize(N);
+
+    std::vector<CheckpointField> ckpt = checkpoint_fields(particles);
+    uint64_t seed       = GALAXY_SEED;
+    int      start_iter = 0;
+    if (resume) {
+        int64_t  saved_iter = 0;
+        uint64_t saved_seed = 0;
+        if (!checkpoint_load(ckpt_path, CHECKPOINT_LAYOUT_SOA, N, saved_iter, saved_seed,
+                             ckpt.data(), (uint32_t)ckpt.size()))
+            return 1;
+        start_iter = (int)saved_iter;
+        seed       = saved_seed;
+        printf("Resumed from %s at iteration %d\n", ckpt_path, start_iter);
+    } else {
+        init_galaxy(particles, N, seed);
+    }
+
+    SnapshotWriter vis;
+    if (do_vis && !snapshot_open(vis, "galaxy_drift.bin", (uint32_t)vis_frames,
+                                compress ? SNAPSHOT_CODEC_QDELTA : SNAPSHOT_CODEC_RAW))
+        return 1;
+
+    // Helper: append one subsampled frame to the seekable snapshot file.
+    auto dump_frame = [&](int iter) {
+        if (!snapshot_write_frame(vis, iter, iter * (double)dt,
+                                  particles.x.data(), particles.y.data(), particles.z.data(),
+                                  sizeof(float), N, vis_stride)) {
+            fprintf(stderr, "snapshot: write failed at iteration %d\n", iter);
+            exit(1);
+        }
+    };
+
+    if (do_vis) dump_frame(start_iter);
+
+    for (int iter = start_iter; iter < iters; ) {
+        if (temporal_k == 1) {
+            update_positions(particles, N, dt);
+            ++iter;
+        } else {
+            // A block may not run past the next snapshot or checkpoint.
+            int steps = std::min(temporal_k, iters - iter);
+            if (do_vis)         steps = std::min(steps, vis_interval - iter % vis_interval);
+            if (ckpt_every > 0) steps = std::min(steps, ckpt_every - iter % ckpt_every);
+            update_positions_blocked(particles, N, dt, steps, block);
+            iter += steps;
+        }
+
+        if (do_vis && iter % vis_interval == 0)
+            dump_frame(iter);
+
+        if (ckpt_every > 0 && iter % ckpt_every == 0 &&
+            !checkpoint_save(ckpt_path, CHECKPOINT_LAYOUT_SOA, N, iter, seed,
+                             ckpt.data(), (uint32_t)ckpt.size()))
+            return 1;
+    }
+
+    snapshot_close(vis);
+
+    // Checksum — same formula as soa_optimized; values must match.
+    double checksum = 0.0;
+    for (int i = 0; i < N; ++i)
+        checksum += particles.x[i] + particles.y[i] + particles.z[i];
+
+    printf("SoA checksum: %.6f\n", checksum);
+    return 0;
+}
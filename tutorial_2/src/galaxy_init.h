@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+// Counter-based random numbers for galaxy initialisation.
+//
+// The original initialisation advanced one global LCG per draw, so particle i
+// could only be generated after particles 0..i-1. Here every draw is a pure
+// function of (seed, particle index, draw number): a SplitMix64 finaliser
+// applied to a Weyl-sequence counter. Any particle can be generated on its own,
+// so the loop runs in parallel and produces bit-identical results for any
+// thread count or chunking. It is not vectorised: logf, sinf and cosf are
+// scalar libm calls at -O2.
+// ----------------------------------------------------------------------------
+
+static const uint64_t GALAXY_SEED           = 0x12345678u;
+static const uint32_t GALAXY_DRAWS_PER_PART = 4;   // uniforms consumed per particle
+
+static inline uint32_t rng_u32(uint64_t seed, uint64_t counter) {
+    uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return (uint32_t)(z >> 32);
+}
+
+// Uniform float in [0, 1) for draw k of particle i.
+static inline float rng_float(uint64_t seed, uint64_t i, uint32_t k) {
+    uint32_t u = rng_u32(seed, i * GALAXY_DRAWS_PER_PART + k);
+    return (float)(u >> 8) * (1.0f / 16777216.0f);
+}
+
+struct GalaxyParticle {
+    float x, y, z;
+    float vx, vy, vz;
+};
+
+// Initial state of particle i of a four-arm logarithmic spiral galaxy with a
+// flat rotation curve. Both layouts call this, so AoS and SoA start from
+// identical positions and their checksums match.
+static inline GalaxyParticle galaxy_particle(uint64_t seed, uint64_t i) {
+    const float PI      = 3.14159265f;
+    const float v0      = 2.0f;   // orbital speed (flat rotation curve)
+    const float winding = 3.5f;   // logarithmic spiral winding constant
+    const float r_min   = 0.5f;   // inner edge of disk
+    const float r_scale = 2.2f;   // exponential scale radius
+    const float r_max   = 9.0f;   // outer cutoff
+    const float scatter = 0.30f;  // angular scatter around arm centreline
+    const float z_scale = 0.15f;  // disk half-thickness
+
+    // Distribute particles evenly across four arms (offset by π/2 each).
+    float arm_offset = (i % 4) * (PI / 2.0f);
+
+    // Sample radius from an exponential distribution. Particles beyond r_max
+    // are redrawn uniformly in [r_min, r_max].
+    float r_exp = r_min - r_scale * logf(rng_float(seed, i, 0) + 1e-7f);
+    float r_uni = r_min + (r_max - r_min) * rng_float(seed, i, 1);
+    float r     = r_exp > r_max ? r_uni : r_exp;
+
+    // One Box-Muller pair gives both Gaussians this particle needs
+    // (angular scatter and height), halving the log/sqrt/sincos calls.
+    float u   = rng_float(seed, i, 2) + 1e-7f;
+    float v   = rng_float(seed, i, 3);
+    float rad = sqrtf(-2.0f * logf(u));
+    float g0  = rad * cosf(2.0f * PI * v);
+    float g1  = rad * sinf(2.0f * PI * v);
+
+    // Logarithmic spiral: θ = arm_offset + winding * ln(r / r_min) + scatter
+    float theta = arm_offset + winding * logf(r / r_min) + g0 * scatter;
+    float s = sinf(theta), c = cosf(theta);
+
+    GalaxyParticle p;
+    p.x  = r * c;
+    p.y  = r * s;
+    p.z  = g1 * z_scale;
+    // Flat rotation curve: tangential speed = v0 regardless of radius.
+    // vtan direction = (-sin θ, cos θ, 0).
+    p.vx = -v0 * s;
+    p.vy =  v0 * c;
+    p.vz =  0.0f;
+    return p;
+}
@@ -0,0 +1,311 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include "barnes_hut.h"
+#include "direct_sum.h"
+#include "fmm.h"
+#include "integrator.h"
+#include "particles_soa.h"
+#include "reorder.h"
+
+// Self-gravitating version of the tutorial_2 galaxy.
+//
+// aos_baseline and soa_optimized only drift particles (x += v*dt), so the
+// velocities never change. This program adds a Barnes–Hut force stage over
+// the same ParticlesSoA arrays and integrates with a leapfrog (integrator.h)
+// whose merged kick and drift run as one pass per tick:
+//
+//   build octree -> walk for accelerations -> { v += a*dt; x += v*dt }
+//
+// --bins B splits each --dt step into 2^B ticks. Each particle gets a bin
+// from its acceleration, and only particles whose bin ends on a tick get new
+// forces there.
+//
+// --reorder-every K sorts all particle arrays along a Morton or Hilbert curve
+// (reorder.h) every K steps, so spatial neighbours are memory neighbours.
+//
+// It reports tree-build time, walk time and interactions per second so the
+// force stage can be measured at 1M particles.
+//
+// --solver fmm swaps the walk for the fast multipole method (fmm.h) with
+// expansion order --order. --compare skips the time loop and instead times
+// Barnes–Hut and FMM at several accuracy settings against O(N^2) direct
+// summation on the initial conditions — use a small N (~20k) for that.
+//
+// Usage:
+//   ./galaxy_nbody [--particles N] [--steps S] [--theta T] [--leaf L]
+//                  [--softening E] [--dt DT] [--solver bh|fmm] [--order P]
+//                  [--compare] [--bins B] [--eta E]
+//                  [--reorder-every K] [--curve morton|hilbert]
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// RMS and maximum of |a - a_ref| / |a_ref| over all particles.
+static void force_error(const std::vector<float>& ax, const std::vector<float>& ay,
+                        const std::vector<float>& az, const std::vector<float>& rx,
+                        const std::vector<float>& ry, const std::vector<float>& rz,
+                        double& rms, double& max_err) {
+    double sum = 0.0;
+    max_err = 0.0;
+    const size_t n = ax.size();
+    for (size_t i = 0; i < n; ++i) {
+        const double ex = ax[i] - rx[i], ey = ay[i] - ry[i], ez = az[i] - rz[i];
+        const double ref = (double)rx[i] * rx[i] + (double)ry[i] * ry[i] + (double)rz[i] * rz[i];
+        const double e = ref > 0.0 ? sqrt((ex * ex + ey * ey + ez * ez) / ref) : 0.0;
+        sum += e * e;
+        if (e > max_err) max_err = e;
+    }
+    rms = sqrt(sum / (double)n);
+}
+
+// Accuracy-vs-time table for Barnes–Hut and FMM against direct summation.
+static void compare_solvers(const ParticlesSoA& p, int n, const BHParams& base, int leaf) {
+    std::vector<float> rx(n), ry(n), rz(n), ax(n), ay(n), az(n);
+
+    auto t0 = std::chrono::steady_clock::now();
+    direct_accelerations(p, n, base.G, base.softening, rx.data(), ry.data(), rz.data());
+    const double t_direct = seconds_since(t0);
+
+    printf("solver,theta,order,time_ms,speedup,rms_rel_err,max_rel_err\n");
+    printf("direct,-,-,%.2f,1.00,0,0\n", t_direct * 1e3);
+
+    const float thetas[] = { 0.3f, 0.5f, 0.7f, 1.0f };
+    for (float theta : thetas) {
+        BHParams prm = base;
+        prm.theta = theta;
+        BHTree tree;
+        t0 = std::chrono::steady_clock::now();
+        bh_build(tree, p, n, prm);
+        bh_accelerations(tree, prm, ax.data(), ay.data(), az.data());
+        const double t = seconds_since(t0);
+        double rms, mx;
+        force_error(ax, ay, az, rx, ry, rz, rms, mx);
+        printf("bh,%.2f,-,%.2f,%.2f,%.3e,%.3e\n", theta, t * 1e3, t_direct / t, rms, mx);
+    }
+
+    const float fmm_thetas[] = { 0.5f, 0.7f };
+    for (float theta : fmm_thetas) {
+        for (int order = 1; order <= 8; ++order) {
+            FMMSolver fmm;
+            fmm.prm.order     = order;
+            fmm.prm.theta     = theta;
+            fmm.prm.softening = base.softening;
+            fmm.prm.G         = base.G;
+            fmm.prm.leaf_size = leaf;
+            fmm.tab.init(order);   // table setup is one-off, keep it out of the timing
+            t0 = std::chrono::steady_clock::now();
+            fmm_accelerations(fmm, p, n, ax.data(), ay.data(), az.data());
+            const double t = seconds_since(t0);
+            double rms, mx;
+            force_error(ax, ay, az, rx, ry, rz, rms, mx);
+            printf("fmm,%.2f,%d,%.2f,%.2f,%.3e,%.3e\n",
+                   theta, order, t * 1e3, t_direct / t, rms, mx);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int   N     = 1 << 20;
+    int   steps = 10;
+    float dt    = 0.005f;
+    BHParams prm;
+    FMMSolver fmm;
+    bool use_fmm = false, compare = false;
+    int   bins = 0;
+    float eta  = 0.02f;
+    int   reorder_every = 0;
+    ReorderCurve curve  = REORDER_HILBERT;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            N = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            steps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+            prm.theta = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--leaf") == 0 && i + 1 < argc) {
+            prm.leaf_size = fmm.prm.leaf_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--softening") == 0 && i + 1 < argc) {
+            prm.softening = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            dt = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "fmm") == 0) {
+                use_fmm = true;
+            } else if (strcmp(argv[i], "bh") != 0) {
+                fprintf(stderr, "Unknown solver '%s' (expected bh or fmm)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc) {
+            fmm.prm.order = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compare") == 0) {
+            compare = true;
+        } else if (strcmp(argv[i], "--bins") == 0 && i + 1 < argc) {
+            bins = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eta") == 0 && i + 1 < argc) {
+            eta = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--reorder-every") == 0 && i + 1 < argc) {
+            reorder_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--curve") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "morton") == 0) {
+                curve = REORDER_MORTON;
+            } else if (strcmp(argv[i], "hilbert") == 0) {
+                curve = REORDER_HILBERT;
+            } else {
+                fprintf(stderr, "Unknown curve '%s' (expected morton or hilbert)\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--particles N] [--steps S] [--theta T] [--leaf L] "
+                            "[--softening E] [--dt DT] [--solver bh|fmm] [--order P] "
+                            "[--compare] [--bins B] [--eta E] [--reorder-every K] "
+                            "[--curve morton|hilbert]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (N < 1 || prm.leaf_size < 1 || prm.theta <= 0.0f) {
+        fprintf(stderr, "particles, leaf size and theta must be positive\n");
+        return 1;
+    }
+    if (bins < 0 || bins >= LEAPFROG_MAX_BINS) {
+        fprintf(stderr, "--bins must be between 0 and %d\n", LEAPFROG_MAX_BINS - 1);
+        return 1;
+    }
+    if (fmm.prm.order < 1 || fmm.prm.order > FMM_MAX_ORDER) {
+        fprintf(stderr, "FMM order must be between 1 and %d\n", FMM_MAX_ORDER);
+        return 1;
+    }
+
+    ParticlesSoA particles;
+    particles.resize(N);
+    init_galaxy(particles, N, GALAXY_SEED);
+
+    // Choose G so the disk's total mass roughly supports the initial flat
+    // rotation curve (v0 = 2 at a typical radius of ~4.5): G M / r ~ v0^2.
+    double total_mass = 0.0;
+    for (int i = 0; i < N; ++i) total_mass += particles.mass[i];
+    prm.G = (float)(2.0 * 2.0 * 4.5 / total_mass);
+
+    if (compare) {
+        compare_solvers(particles, N, prm, fmm.prm.leaf_size);
+        return 0;
+    }
+
+    std::vector<float> ax(N), ay(N), az(N);
+    BHTree tree;
+
+    if (use_fmm) {
+        fmm.prm.theta     = prm.theta;
+        fmm.prm.softening = prm.softening;
+        fmm.prm.G         = prm.G;
+        printf("FMM: N=%d  order=%d  theta=%.2f  leaf=%d  softening=%.3f  dt=%.4f\n",
+               N, fmm.prm.order, prm.theta, fmm.prm.leaf_size, prm.softening, dt);
+    } else {
+        printf("Barnes-Hut: N=%d  theta=%.2f  leaf=%d  softening=%.3f  dt=%.4f\n",
+               N, prm.theta, prm.leaf_size, prm.softening, dt);
+    }
+
+    // Forces for the particles flagged in active (all when null). FMM always
+    // evaluates everything and the integrator ignores the inactive results.
+    auto compute_forces = [&](const uint8_t* active, double& tb, double& tw) -> uint64_t {
+        if (use_fmm) {
+            // Build, upward pass, traversal and downward pass in one call;
+            // "interactions" counts P2P pairs plus M2L translations.
+            auto t0 = std::chrono::steady_clock::now();
+            FMMStats st = fmm_accelerations(fmm, particles, N, ax.data(), ay.data(), az.data());
+            tw += seconds_since(t0);
+            return st.p2p_pairs + st.m2l;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        bh_build(tree, particles, N, prm);
+        tb += seconds_since(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        uint64_t inter = bh_accelerations(tree, prm, ax.data(), ay.data(), az.data(), active);
+        tw += seconds_since(t0);
+        return inter;
+    };
+
+    Leapfrog lf;
+    lf.prm.dt        = dt;
+    lf.prm.max_bin   = bins;
+    lf.prm.eta       = eta;
+    lf.prm.softening = prm.softening;
+    {
+        double tb = 0.0, tw = 0.0;
+        compute_forces(nullptr, tb, tw);
+        leapfrog_begin(lf, particles, N, ax.data(), ay.data(), az.data());
+    }
+
+    Reorder reorder;
+    std::vector<uint8_t> scratch8;
+
+    double t_build = 0.0, t_walk = 0.0, t_kd = 0.0, t_reorder = 0.0;
+    uint64_t total_interactions = 0;
+    const uint64_t ticks = leapfrog_period(lf.prm, 0);
+    for (int step = 0; step < steps; ++step) {
+        double   tb = 0.0, tw = 0.0, tk = 0.0;
+        uint64_t inter = 0, updates = 0;
+        double   tr = 0.0;
+        if (reorder_every > 0 && step % reorder_every == 0) {
+            // Between steps every particle is synchronised; the integrator's
+            // per-particle state and the accelerations move with the particles.
+            auto t0 = std::chrono::steady_clock::now();
+            reorder_particles(reorder, particles, N, curve);
+            reorder_apply(reorder, ax, reorder.arena);
+            reorder_apply(reorder, ay, reorder.arena);
+            reorder_apply(reorder, az, reorder.arena);
+            reorder_apply(reorder, lf.bin, scratch8);
+            reorder_apply(reorder, lf.active, scratch8);
+            tr = seconds_since(t0);
+        }
+        for (uint64_t t = 0; t < ticks; ++t) {
+            auto t0 = std::chrono::steady_clock::now();
+            int n_active = leapfrog_kick_drift(lf, particles, N, ax.data(), ay.data(), az.data());
+            tk += seconds_since(t0);
+            if (n_active == 0) continue;
+            inter   += compute_forces(lf.active.data(), tb, tw);
+            updates += n_active;
+        }
+
+        printf("step %3d  reorder %7.2f ms  build %8.2f ms  walk %9.2f ms  kick-drift %7.2f ms  "
+               "%5.2f force updates/particle  %6.0f interactions/particle  "
+               "%8.2f M interactions/s\n",
+               step, tr * 1e3, tb * 1e3, tw * 1e3, tk * 1e3, (double)updates / N,
+               (double)inter / N, inter / tw * 1e-6);
+        t_build += tb;
+        t_walk  += tw;
+        t_kd    += tk;
+        t_reorder += tr;
+        total_interactions += inter;
+    }
+    leapfrog_finish(lf, particles, N, ax.data(), ay.data(), az.data());
+
+    if (steps > 0) {
+        printf("mean: reorder %.2f ms  build %.2f ms  walk %.2f ms  kick-drift %.2f ms  "
+               "%.2f M interactions/s (walk only)  %.2f M interactions/s (build + walk)\n",
+               t_reorder / steps * 1e3, t_build / steps * 1e3, t_walk / steps * 1e3, t_kd / steps * 1e3,
+               total_interactions / t_walk * 1e-6,
+               total_interactions / (t_build + t_walk) * 1e-6);
+
+        std::vector<int> hist(bins + 1, 0);
+        for (int i = 0; i < N; ++i) ++hist[lf.bin[i]];
+        printf("timestep bins:");
+        for (int b = 0; b <= bins; ++b) printf("  dt/%d: %d", 1 << b, hist[b]);
+        printf("\n");
+    }
+
+    double checksum = 0.0;
+    for (int i = 0; i < N; ++i)
+        checksum += particles.x[i] + particles.y[i] + particles.z[i];
+    printf("N-body checksum: %.6f\n", checksum);
+    return 0;
+}
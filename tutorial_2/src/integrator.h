@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "particles_soa.h"
+
+// ----------------------------------------------------------------------------
+// Kick-drift-kick leapfrog with hierarchical (power-of-two) timestep bins.
+//
+// Bin b advances with dt / 2^b. Time is counted in ticks of the smallest step,
+// dt / 2^max_bin, so a particle in bin b finishes a step every
+// 2^(max_bin - b) ticks and is "active" on those ticks only. Only active
+// particles need new accelerations, so a force solver that honours the active
+// mask skips the slowly-moving outer disk on most ticks.
+//
+// The closing half-kick of one step and the opening half-kick of the next
+// fall on the same tick, so they are merged into one kick, which is then fused
+// with the drift:
+//
+//   for every particle:  if active: v += a * (dt_old + dt_new) / 2
+//                        x += v * dt_tick
+//
+// That is one streaming pass over x, y, z, vx, vy, vz (+ a and the bin byte)
+// per tick, instead of separate kick and drift loops over the hot arrays.
+// Every particle drifts on every tick, so positions are always synchronised
+// for the force solver. Velocities are half a step ahead until
+// leapfrog_finish applies the last closing half-kick.
+//
+// A particle's bin is chosen from dt_i = eta * sqrt(softening / |a|) when it
+// is active. It may always move to a finer bin. It may move to a coarser bin
+// only on a tick where that bin is also synchronised.
+// ----------------------------------------------------------------------------
+
+static const int LEAPFROG_MAX_BINS = 16;
+
+struct LeapfrogParams {
+    float dt        = 0.005f;  // step of bin 0
+    int   max_bin   = 0;       // 0 = one global timestep
+    float eta       = 0.02f;   // timestep accuracy parameter
+    float softening = 0.05f;   // length scale for the acceleration criterion
+};
+
+struct Leapfrog {
+    LeapfrogParams       prm;
+    std::vector<uint8_t> bin;      // timestep bin per particle
+    std::vector<uint8_t> active;   // 1 if the particle's step ends on this tick
+    uint64_t             tick = 0; // time in units of dt / 2^max_bin
+    int                  n_active = 0;
+};
+
+// Ticks per step of bin b.
+static inline uint64_t leapfrog_period(const LeapfrogParams& prm, int b) {
+    return (uint64_t)1 << (prm.max_bin - b);
+}
+
+// Finest bin the acceleration asks for, no coarser than min_bin.
+static inline int leapfrog_bin_for(const LeapfrogParams& prm, float ax, float ay, float az,
+                                   int min_bin) {
+    const float a2 = ax * ax + ay * ay + az * az;
+    if (a2 <= 0.0f) return min_bin;
+    const float dt_i = prm.eta * sqrtf(prm.softening / sqrtf(a2));
+    int b = min_bin;
+    while (b < prm.max_bin && ldexpf(prm.dt, -b) > dt_i) ++b;
+    return b;
+}
+
+// Assign initial bins and apply the opening half-kick. Accelerations must be
+// current for every particle.
+static void leapfrog_begin(Leapfrog& lf, ParticlesSoA& p, int n,
+                           const float* ax, const float* ay, const float* az) {
+    lf.bin.assign(n, 0);
+    lf.active.assign(n, 0);
+    lf.tick     = 0;
+    lf.n_active = 0;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        const int   b = leapfrog_bin_for(lf.prm, ax[i], ay[i], az[i], 0);
+        const float h = 0.5f * ldexpf(lf.prm.dt, -b);
+        lf.bin[i] = (uint8_t)b;
+        p.vx[i] += ax[i] * h;
+        p.vy[i] += ay[i] * h;
+        p.vz[i] += az[i] * h;
+    }
+}
+
+// One tick: merged kick for the active particles, drift for all of them,
+// then advance the clock and mark which particles need forces next.
+// Returns the number of newly active particles.
+static int leapfrog_kick_drift(Leapfrog& lf, ParticlesSoA& p, int n,
+                               const float* ax, const float* ay, const float* az) {
+    const LeapfrogParams& prm     = lf.prm;
+    const float           dt_tick = ldexpf(prm.dt, -prm.max_bin);
+    const uint64_t        next    = lf.tick + 1;
+
+    // Coarsest bin synchronised on this tick; active particles may not
+    // leave it for anything coarser.
+    int sync_bin = prm.max_bin;
+    while (sync_bin > 0 && lf.tick % leapfrog_period(prm, sync_bin - 1) == 0) --sync_bin;
+
+    float* x  = p.x.data();  float* y  = p.y.data();  float* z  = p.z.data();
+    float* vx = p.vx.data(); float* vy = p.vy.data(); float* vz = p.vz.data();
+    uint8_t* bin    = lf.bin.data();
+    uint8_t* active = lf.active.data();
+    int n_next = 0;
+
+    #pragma omp parallel for schedule(static) reduction(+: n_next)
+    for (int i = 0; i < n; ++i) {
+        float h = 0.0f;
+        int   b = bin[i];
+        if (active[i]) {
+            const int nb = leapfrog_bin_for(prm, ax[i], ay[i], az[i], sync_bin);
+            h = 0.5f * (ldexpf(prm.dt, -b) + ldexpf(prm.dt, -nb));
+            b = nb;
+            bin[i] = (uint8_t)nb;
+        }
+        vx[i] += ax[i] * h;
+        vy[i] += ay[i] * h;
+        vz[i] += az[i] * h;
+        x[i]  += vx[i] * dt_tick;
+        y[i]  += vy[i] * dt_tick;
+        z[i]  += vz[i] * dt_tick;
+
+        const uint8_t on = next % leapfrog_period(prm, b) == 0;
+        active[i] = on;
+        n_next += on;
+    }
+
+    lf.tick     = next;
+    lf.n_active = n_next;
+    return n_next;
+}
+
+// Closing half-kick for the active particles, leaving their velocities
+// synchronised with their positions. Call at a tick where every particle is
+// active (any multiple of 2^max_bin ticks), after computing forces.
+static void leapfrog_finish(Leapfrog& lf, ParticlesSoA& p, int n,
+                            const float* ax, const float* ay, const float* az) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        if (!lf.active[i]) continue;
+        const float h = 0.5f * ldexpf(lf.prm.dt, -lf.bin[i]);
+        p.vx[i] += ax[i] * h;
+        p.vy[i] += ay[i] * h;
+        p.vz[i] += az[i] * h;
+        lf.active[i] = 0;
+    }
+    lf.n_active = 0;
+}
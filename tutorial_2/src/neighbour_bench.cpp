@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "cell_list.h"
+#include "particles_soa.h"
+
+// Neighbour-search benchmark for the cell list (cell_list.h).
+//
+// For each search radius: build the cell list over the galaxy, then count
+// every ordered pair (i, j != i) closer than the radius. The counting loop
+// has the same shape as an SPH density pass (9 contiguous candidate runs per
+// cell, vectorised distance test), so its pairs/s is an upper bound on what a
+// short-range force stage can achieve.
+//
+// Usage:
+//   ./neighbour_bench [--particles N] [--radii r1,r2,...] [--repeat K]
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[]) {
+    int N      = 1 << 20;
+    int repeat = 3;
+    std::vector<float> radii;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            N = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--radii") == 0 && i + 1 < argc) {
+            for (char* tok = strtok(argv[++i], ","); tok; tok = strtok(nullptr, ","))
+                radii.push_back((float)atof(tok));
+        } else {
+            fprintf(stderr, "Usage: %s [--particles N] [--radii r1,r2,...] [--repeat K]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (radii.empty()) {
+        const float defaults[] = { 0.01f, 0.02f, 0.05f, 0.1f, 0.2f };
+        radii.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+    if (N < 1 || repeat < 1) {
+        fprintf(stderr, "particles and repeat must be positive\n");
+        return 1;
+    }
+    for (size_t r = 0; r < radii.size(); ++r) {
+        if (radii[r] <= 0.0f) {
+            fprintf(stderr, "radii must be positive\n");
+            return 1;
+        }
+    }
+
+    ParticlesSoA particles;
+    particles.resize(N);
+    init_galaxy(particles, N, GALAXY_SEED);
+
+    printf("Neighbour search: N=%d, best of %d runs per radius\n", N, repeat);
+    printf("%8s %8s %12s %10s %10s %12s %12s %14s %14s\n",
+           "radius", "cell", "cells", "build ms", "query ms", "neigh/part",
+           "cand/part", "M pairs/s", "M cand/s");
+
+    CellList cl;
+    for (size_t r = 0; r < radii.size(); ++r) {
+        const float radius = radii[r];
+        const float r2     = radius * radius;
+        double best_build = 1e30, best_query = 1e30;
+        uint64_t pairs = 0, candidates = 0;
+
+        for (int rep = 0; rep < repeat; ++rep) {
+            auto t0 = std::chrono::steady_clock::now();
+            cell_list_build(cl, particles, N, radius);
+            best_build = std::min(best_build, seconds_since(t0));
+
+            const long n_cells = (long)cell_list_cells(cl);
+            const float* px = cl.px.data();
+            const float* py = cl.py.data();
+            const float* pz = cl.pz.data();
+            uint64_t p_sum = 0, c_sum = 0;
+
+            t0 = std::chrono::steady_clock::now();
+            #pragma omp parallel for schedule(dynamic, 256) reduction(+: p_sum, c_sum)
+            for (long c = 0; c < n_cells; ++c) {
+                const uint32_t b = cl.cell_start[c], e = cl.cell_start[c + 1];
+                if (b == e) continue;
+                uint32_t rb[9], re[9];
+                const int n_ranges = cell_list_ranges(cl, (size_t)c, rb, re);
+                for (uint32_t k = b; k < e; ++k) {
+                    const float xk = px[k], yk = py[k], zk = pz[k];
+                    for (int q = 0; q < n_ranges; ++q) {
+                        uint32_t count = 0;
+                        #pragma omp simd reduction(+: count)
+                        for (uint32_t j = rb[q]; j < re[q]; ++j) {
+                            const float dx = px[j] - xk, dy = py[j] - yk, dz = pz[j] - zk;
+                            count += dx * dx + dy * dy + dz * dz < r2;
+                        }
+                        p_sum += count;
+                        c_sum += re[q] - rb[q];
+                    }
+                    p_sum -= 1;   // the particle itself
+                }
+            }
+            best_query = std::min(best_query, seconds_since(t0));
+            pairs      = p_sum;
+            candidates = c_sum;
+        }
+
+        printf("%8.3f %8.3f %12zu %10.2f %10.2f %12.2f %12.2f %14.2f %14.2f\n",
+               radius, cl.cell, cell_list_cells(cl), best_build * 1e3, best_query * 1e3,
+               (double)pairs / N, (double)candidates / N,
+               pairs / best_query * 1e-6, candidates / best_query * 1e-6);
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "particles_aos.h"
+#include "particles_half.h"
+#include "particles_soa.h"
+
+// Layout benchmark for the drift step (x += v * dt).
+//
+// Runs every particle layout over a sweep of particle counts and thread
+// counts and reports, for each point:
+//
+//   ns/particle/step   wall time per particle update
+//   GB/s               compulsory traffic per particle-step / time
+//   efficiency         t(1 thread) / (threads * t(threads))
+//
+// Layouts:
+//   aos        ParticleAoS, 64 bytes per particle (aos_baseline)
+//   soa        ParticlesSoA, one array per field (soa_optimized)
+//   aosoa      blocks of AOSOA_WIDTH particles, one array per field per block
+//   soa-fp16   SoA positions with FP16 velocities (particles_half.h)
+//   soa-bf16   SoA positions with BF16 velocities
+//
+// The default sizes run from 1K to 16M particles, so the 24-byte hot state
+// crosses L1, L2, the last-level cache and DRAM. The cache sizes are printed
+// in the header. Every kernel is an `omp simd` loop, so all layouts are
+// compared vectorised. Each point takes the best of --repeat timed runs.
+//
+// Usage:
+//   ./particle_bench [--layouts a,b,...] [--sizes n1,n2,...] [--threads t1,t2,...]
+//                    [--repeat R] [--csv PATH] [--json PATH]
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static const int AOSOA_WIDTH = 16;
+
+// Array-of-Structures-of-Arrays: every field of AOSOA_WIDTH particles is one
+// 64-byte run. The drift reads six whole lines per block and skips the other
+// nine, so it streams as well as SoA from a single allocation.
+struct ParticleBlockAoSoA {
+    float x[AOSOA_WIDTH], y[AOSOA_WIDTH], z[AOSOA_WIDTH];
+    float vx[AOSOA_WIDTH], vy[AOSOA_WIDTH], vz[AOSOA_WIDTH];
+    float mass[AOSOA_WIDTH], charge[AOSOA_WIDTH], temperature[AOSOA_WIDTH];
+    float pressure[AOSOA_WIDTH], energy[AOSOA_WIDTH], density[AOSOA_WIDTH];
+    float spin_x[AOSOA_WIDTH], spin_y[AOSOA_WIDTH], spin_z[AOSOA_WIDTH];
+};
+
+enum Layout { LAYOUT_AOS, LAYOUT_SOA, LAYOUT_AOSOA, LAYOUT_FP16, LAYOUT_BF16, LAYOUT_COUNT };
+
+static const char* const LAYOUT_NAMES[LAYOUT_COUNT] = {
+    "aos", "soa", "aosoa", "soa-fp16", "soa-bf16",
+};
+
+// Compulsory memory traffic per particle-step. AoS moves the whole 64-byte
+// line in and writes it back; the others read the hot fields and write the
+// positions.
+static const int LAYOUT_BYTES[LAYOUT_COUNT] = { 128, 36, 36, 30, 30 };
+
+// Bytes of hot state per particle, for the working-set column.
+static const int LAYOUT_HOT_BYTES[LAYOUT_COUNT] = { 64, 24, 24, 18, 18 };
+
+struct BenchParticles {
+    Layout                          layout = LAYOUT_SOA;
+    int                             n = 0;
+    std::vector<ParticleAoS>        aos;
+    ParticlesSoA                    soa;
+    std::vector<ParticleBlockAoSoA> aosoa;
+    ParticlesHalf                   half;
+};
+
+static void bench_init(BenchParticles& b, Layout layout, int n) {
+    b = BenchParticles();
+    b.layout = layout;
+    b.n      = n;
+    switch (layout) {
+    case LAYOUT_AOS:
+        b.aos.resize(n);
+        init_galaxy(b.aos.data(), n, GALAXY_SEED);
+        break;
+    case LAYOUT_SOA:
+        b.soa.resize(n);
+        init_galaxy(b.soa, n, GALAXY_SEED);
+        break;
+    case LAYOUT_AOSOA: {
+        const int n_blocks = (n + AOSOA_WIDTH - 1) / AOSOA_WIDTH;
+        b.aosoa.resize(n_blocks);
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < n_blocks; ++k) {
+            ParticleBlockAoSoA& blk = b.aosoa[k];
+            memset(&blk, 0, sizeof(blk));
+            for (int j = 0; j < AOSOA_WIDTH && k * AOSOA_WIDTH + j < n; ++j) {
+                GalaxyParticle g = galaxy_particle(GALAXY_SEED, (uint64_t)k * AOSOA_WIDTH + j);
+                blk.x[j]  = g.x;  blk.y[j]  = g.y;  blk.z[j]  = g.z;
+                blk.vx[j] = g.vx; blk.vy[j] = g.vy; blk.vz[j] = g.vz;
+                blk.mass[j] = 1.0f;
+            }
+        }
+        break;
+    }
+    case LAYOUT_FP16:
+    case LAYOUT_BF16: {
+        ParticlesSoA soa;
+        soa.resize(n);
+        init_galaxy(soa, n, GALAXY_SEED);
+        half_from_soa(b.half, soa, n, layout == LAYOUT_FP16 ? HALF_FP16 : HALF_BF16, false);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Particles [i0, i1) one step forward. i0 and i1 are multiples of
+// AOSOA_WIDTH (or n), so AoSoA blocks are never split between threads.
+static void bench_update(BenchParticles& b, float dt, int i0, int i1) {
+    switch (b.layout) {
+    case LAYOUT_AOS: {
+        ParticleAoS* p = b.aos.data();
+        #pragma omp simd
+        for (int i = i0; i < i1; ++i) {
+            p[i].x += p[i].vx * dt;
+            p[i].y += p[i].vy * dt;
+            p[i].z += p[i].vz * dt;
+        }
+        break;
+    }
+    case LAYOUT_SOA: {
+        float* x = b.soa.x.data();
+        float* y = b.soa.y.data();
+        float* z = b.soa.z.data();
+        const float* vx = b.soa.vx.data();
+        const float* vy = b.soa.vy.data();
+        const float* vz = b.soa.vz.data();
+        #pragma omp simd
+        for (int i = i0; i < i1; ++i) {
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            z[i] += vz[i] * dt;
+        }
+        break;
+    }
+    case LAYOUT_AOSOA:
+        for (int k = i0 / AOSOA_WIDTH; k * AOSOA_WIDTH < i1; ++k) {
+            ParticleBlockAoSoA& blk = b.aosoa[k];
+            #pragma omp simd
+            for (int j = 0; j < AOSOA_WIDTH; ++j) {
+                blk.x[j] += blk.vx[j] * dt;
+                blk.y[j] += blk.vy[j] * dt;
+                blk.z[j] += blk.vz[j] * dt;
+            }
+        }
+        break;
+    case LAYOUT_FP16:
+        half_update_range<HALF_FP16>(b.half, dt, i0, i1);
+        break;
+    case LAYOUT_BF16:
+        half_update_range<HALF_BF16>(b.half, dt, i0, i1);
+        break;
+    default:
+        break;
+    }
+}
+
+// One step with the given number of threads, statically partitioned.
+static void bench_step(BenchParticles& b, float dt, int threads) {
+    const int units = (b.n + AOSOA_WIDTH - 1) / AOSOA_WIDTH;
+    #pragma omp parallel num_threads(threads)
+    {
+        int t = 0, nt = 1;
+#ifdef _OPENMP
+        t  = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#endif
+        const int i0 = std::min(b.n, (int)((int64_t)units * t / nt) * AOSOA_WIDTH);
+        const int i1 = std::min(b.n, (int)((int64_t)units * (t + 1) / nt) * AOSOA_WIDTH);
+        bench_update(b, dt, i0, i1);
+    }
+}
+
+static bool parse_list(char* arg, std::vector<long>& out) {
+    out.clear();
+    for (char* tok = strtok(arg, ","); tok; tok = strtok(nullptr, ",")) {
+        const long v = atol(tok);
+        if (v < 1) return false;
+        out.push_back(v);
+    }
+    return !out.empty();
+}
+
+static long cache_size(int name) {
+    long v = sysconf(name);
+    return v > 0 ? v : 0;
+}
+
+struct BenchResult {
+    Layout layout;
+    int    n, threads, steps;
+    double ns_per_step, gbps, efficiency;
+};
+
+int main(int argc, char* argv[]) {
+    std::vector<long> sizes, threads;
+    std::vector<Layout> layouts;
+    int         repeat    = 3;
+    const char* csv_path  = nullptr;
+    const char* json_path = nullptr;
+    const float dt        = 0.005f;
+
+    for (int i = 1; i < argc; ++i) {
+        bool ok = true;
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            ok = parse_list(argv[++i], sizes);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            ok = parse_list(argv[++i], threads);
+        } else if (strcmp(argv[i], "--layouts") == 0 && i + 1 < argc) {
+            for (char* tok = strtok(argv[++i], ","); ok && tok; tok = strtok(nullptr, ",")) {
+                int l = 0;
+                while (l < LAYOUT_COUNT && strcmp(tok, LAYOUT_NAMES[l]) != 0) ++l;
+                ok = l < LAYOUT_COUNT;
+                if (ok) layouts.push_back((Layout)l);
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+            ok = repeat > 0;
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Usage: %s [--layouts aos,soa,aosoa,soa-fp16,soa-bf16] "
+                            "[--sizes n1,n2,...] [--threads t1,t2,...] [--repeat R] "
+                            "[--csv PATH] [--json PATH]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t k = 0; k < sizes.size(); ++k) {
+        if (sizes[k] > INT32_MAX) {
+            fprintf(stderr, "sizes must be below %d\n", INT32_MAX);
+            return 1;
+        }
+    }
+    if (layouts.empty())
+        for (int l = 0; l < LAYOUT_COUNT; ++l) layouts.push_back((Layout)l);
+    if (sizes.empty())
+        for (long n = 1 << 10; n <= 1 << 24; n *= 4) sizes.push_back(n);
+    if (threads.empty()) {
+        int max_threads = 1;
+#ifdef _OPENMP
+        max_threads = omp_get_max_threads();
+#endif
+        for (int t = 1; t < max_threads; t *= 2) threads.push_back(t);
+        threads.push_back(max_threads);
+    }
+
+    long l1 = 0, l2 = 0, l3 = 0;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE);
+    l2 = cache_size(_SC_LEVEL2_CACHE_SIZE);
+    l3 = cache_size(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    printf("Drift benchmark: caches L1d %ld KB, L2 %ld KB, L3 %ld KB (0 = not reported), "
+           "best of %d\n", l1 / 1024, l2 / 1024, l3 / 1024, repeat);
+    printf("%-9s %10s %10s %8s %8s %12s %8s %10s\n", "layout", "particles", "hot MB",
+           "threads", "steps", "ns/part/step", "GB/s", "efficiency");
+
+    std::vector<BenchResult> results;
+    BenchParticles b;
+    for (size_t li = 0; li < layouts.size(); ++li) {
+        for (size_t si = 0; si < sizes.size(); ++si) {
+            const Layout layout = layouts[li];
+            const int    n      = (int)sizes[si];
+            bench_init(b, layout, n);
+
+            // About 2^26 particle-steps per timed run, at least 3 steps.
+            const int steps = (int)std::max<long>(3, (1L << 26) / n);
+            double t_single = 0.0;
+            for (size_t ti = 0; ti < threads.size(); ++ti) {
+                const int nt = (int)threads[ti];
+                bench_step(b, dt, nt);   // warm up caches and the thread pool
+                double best = 1e30;
+                for (int rep = 0; rep < repeat; ++rep) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    for (int s = 0; s < steps; ++s) bench_step(b, dt, nt);
+                    best = std::min(best, seconds_since(t0));
+                }
+                if (nt == 1) t_single = best;
+
+                BenchResult r;
+                r.layout      = layout;
+                r.n           = n;
+                r.threads     = nt;
+                r.steps       = steps;
+                r.ns_per_step = best / ((double)n * steps) * 1e9;
+                r.gbps        = (double)LAYOUT_BYTES[layout] * n * steps / best * 1e-9;
+                // 0 when the thread list does not start at one thread.
+                r.efficiency  = t_single > 0.0 ? t_single / (nt * best) : 0.0;
+                results.push_back(r);
+                printf("%-9s %10d %10.3f %8d %8d %12.3f %8.2f %10.2f\n", LAYOUT_NAMES[layout],
+                       n, (double)LAYOUT_HOT_BYTES[layout] * n / (1 << 20), nt, steps,
+                       r.ns_per_step, r.gbps, r.efficiency);
+            }
+        }
+    }
+    b = BenchParticles();
+
+    if (csv_path) {
+        FILE* f = fopen(csv_path, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", csv_path);
+            return 1;
+        }
+        fprintf(f, "layout,particles,threads,steps,hot_bytes,ns_per_particle_step,gb_per_s,efficiency\n");
+        for (size_t k = 0; k < results.size(); ++k) {
+            const BenchResult& r = results[k];
+            fprintf(f, "%s,%d,%d,%d,%lld,%.4f,%.3f,%.3f\n", LAYOUT_NAMES[r.layout], r.n,
+                    r.threads, r.steps, (long long)LAYOUT_HOT_BYTES[r.layout] * r.n,
+                    r.ns_per_step, r.gbps, r.efficiency);
+        }
+        fclose(f);
+    }
+    if (json_path) {
+        FILE* f = fopen(json_path, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+        fprintf(f, "{\n  \"cache_bytes\": {\"l1d\": %ld, \"l2\": %ld, \"l3\": %ld},\n"
+                   "  \"results\": [\n", l1, l2, l3);
+        for (size_t k = 0; k < results.size(); ++k) {
+            const BenchResult& r = results[k];
+            fprintf(f, "    {\"layout\": \"%s\", \"particles\": %d, \"threads\": %d, "
+                       "\"steps\": %d, \"hot_bytes\": %lld, \"ns_per_particle_step\": %.4f, "
+                       "\"gb_per_s\": %.3f, \"efficiency\": %.3f}%s\n",
+                    LAYOUT_NAMES[r.layout], r.n, r.threads, r.steps,
+                    (long long)LAYOUT_HOT_BYTES[r.layout] * r.n, r.ns_per_step, r.gbps,
+                    r.efficiency, k + 1 < results.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "particles_soa.h"
+
+// ----------------------------------------------------------------------------
+// Dynamic particle store: insertion and removal on top of ParticlesSoA.
+//
+// Slots [0, n) of the SoA arrays hold particles; each slot is live or a
+// tombstone. The hot loops keep running over all n slots unchanged:
+//
+//   remove     O(1): mark the slot dead and zero its velocity and mass, so the
+//              tombstone stays put in the drift and adds no gravity
+//   insert     append to a pending batch (amortised O(1), no allocation
+//              once the batch has reached its working size)
+//   commit     between steps, copy the batch to the end of every field
+//   compact    when tombstones pile up, a parallel stream compaction removes
+//              them from every field at once:
+//                1. each thread counts live slots in its static chunk,
+//                2. an exclusive scan turns the counts into write offsets,
+//                3. each thread writes the old slot of its live particles
+//                   to `gather`, in order, and frees the IDs of its dead ones,
+//                4. every field is gathered into one scratch arena, which is
+//                   then swapped with the field (as in reorder.h).
+//
+// Compaction keeps the particles in order, so a space-filling-curve order
+// (reorder.h) survives it. Each particle has a stable ID: `slot` maps IDs to
+// current slots and `id` maps slots back, and compaction rewrites both.
+// Compaction also puts the IDs of the tombstones it drops on a free list,
+// and store_insert takes IDs from there first, so the ID table never grows
+// past the largest slot count the store has had. Every ID has a generation
+// that is bumped when it is freed. Callers hold a ParticleId handle
+// (generation << 32 | ID), so a handle to a removed particle never aliases
+// the new particle that reuses its ID.
+//
+// Per-particle state kept outside the store (accelerations, integrator bins)
+// must be compacted with store_apply, using the same gather, before the
+// gather is overwritten.
+// ----------------------------------------------------------------------------
+
+static const uint32_t STORE_NO_SLOT = 0xffffffffu;
+
+typedef uint64_t ParticleId;   // generation << 32 | ID
+
+struct ParticleStore {
+    ParticlesSoA          p;
+    int                   n = 0;        // slots in use, live or dead
+    int                   n_dead = 0;
+    std::vector<uint8_t>  alive;        // per slot
+    std::vector<uint32_t> id;           // per slot: stable ID
+    std::vector<uint32_t> slot;         // per ID: current slot or STORE_NO_SLOT
+    std::vector<uint32_t> gen;          // per ID: bumped each time the ID is freed
+    std::vector<uint32_t> free_ids;     // IDs released by compaction
+
+    ParticlesSoA          pending;      // inserted since the last commit
+    std::vector<uint32_t> pending_id;
+    int                   n_pending = 0;
+
+    std::vector<uint32_t> gather;       // after compaction: slot k was old slot gather[k]
+    std::vector<int>      counts;       // per-thread live counts, then offsets
+    std::vector<float>    arena;
+    std::vector<uint32_t> id_scratch;
+
+    int live() const { return n - n_dead; }
+};
+
+// Take ownership of n initialised particles; they get IDs 0..n-1.
+static void store_init(ParticleStore& s, int n) {
+    s.n      = n;
+    s.n_dead = 0;
+    s.alive.assign(n, 1);
+    s.id.resize(n);
+    s.slot.resize(n);
+    s.gen.assign(n, 0);
+    s.free_ids.clear();
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        s.id[i]   = (uint32_t)i;
+        s.slot[i] = (uint32_t)i;
+    }
+    s.n_pending = 0;
+}
+
+// Handle for the particle in slot i.
+static inline ParticleId store_handle(const ParticleStore& s, int i) {
+    return (ParticleId)s.gen[s.id[i]] << 32 | s.id[i];
+}
+
+// Queue a new particle; it enters the arrays at the next store_commit.
+// Returns its handle.
+static ParticleId store_insert(ParticleStore& s, const GalaxyParticle& g) {
+    if ((size_t)s.n_pending == s.pending.size()) {
+        s.pending.resize(s.pending.size() < 64 ? 64 : 2 * s.pending.size());
+        s.pending_id.resize(s.pending.size());
+    }
+    uint32_t particle_id;
+    if (!s.free_ids.empty()) {
+        particle_id = s.free_ids.back();
+        s.free_ids.pop_back();
+    } else {
+        particle_id = (uint32_t)s.slot.size();
+        s.slot.push_back(STORE_NO_SLOT);
+        s.gen.push_back(0);
+    }
+    s.pending_id[s.n_pending] = particle_id;
+    soa_set_particle(s.pending, (size_t)s.n_pending++, g);
+    return (ParticleId)s.gen[particle_id] << 32 | particle_id;
+}
+
+// Turn slot i into a tombstone. Safe to call for different slots from
+// several threads; the caller adds the number removed to n_dead.
+static inline bool store_kill_slot(ParticleStore& s, int i) {
+    if (!s.alive[i]) return false;
+    s.alive[i] = 0;
+    s.p.vx[i] = s.p.vy[i] = s.p.vz[i] = 0.0f;
+    s.p.mass[i] = 0.0f;
+    s.slot[s.id[i]] = STORE_NO_SLOT;
+    return true;
+}
+
+// Remove a particle by handle. False if it is not (or no longer) in the
+// arrays, including when its ID has since been given to another particle.
+static bool store_remove(ParticleStore& s, ParticleId h) {
+    const uint32_t particle_id = (uint32_t)h;
+    if (particle_id >= s.slot.size() || s.gen[particle_id] != (uint32_t)(h >> 32) ||
+        s.slot[particle_id] == STORE_NO_SLOT)
+        return false;
+    store_kill_slot(s, (int)s.slot[particle_id]);
+    ++s.n_dead;
+    return true;
+}
+
+// Remove every live particle for which pred(p, i) holds, in parallel.
+// Returns the number removed.
+template <typename Pred>
+static int store_remove_if(ParticleStore& s, Pred pred) {
+    int removed = 0;
+    #pragma omp parallel for schedule(static) reduction(+:removed)
+    for (int i = 0; i < s.n; ++i)
+        if (s.alive[i] && pred(s.p, i) && store_kill_slot(s, i)) ++removed;
+    s.n_dead += removed;
+    return removed;
+}
+
+// Append the pending batch to every field. std::vector grows geometrically,
+// so appends cost amortised O(batch).
+static void store_commit(ParticleStore& s) {
+    if (s.n_pending == 0) return;
+    const int n0 = s.n, k = s.n_pending;
+
+    std::vector<ParticlesSoA::Field> dst = s.p.fields();
+    std::vector<ParticlesSoA::Field> src = s.pending.fields();
+    for (size_t f = 0; f < dst.size(); ++f) {
+        dst[f].data->resize(n0 + k);
+        std::copy(src[f].data->begin(), src[f].data->begin() + k, dst[f].data->begin() + n0);
+    }
+    s.alive.resize(n0 + k, 1);
+    s.id.resize(n0 + k);
+    for (int j = 0; j < k; ++j) {
+        s.id[n0 + j]              = s.pending_id[j];
+        s.slot[s.pending_id[j]]   = (uint32_t)(n0 + j);
+    }
+    s.n         = n0 + k;
+    s.n_pending = 0;
+}
+
+// Permute one array by the last compaction's gather (new size = live count).
+template <typename T>
+static void store_apply(const ParticleStore& s, std::vector<T>& data, std::vector<T>& scratch) {
+    const int n = (int)s.gather.size();
+    scratch.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) scratch[k] = data[s.gather[k]];
+    std::swap(data, scratch);
+}
+
+// Remove all tombstones, keeping the live particles in order, and free their
+// IDs. Returns false (and leaves gather alone) if there are none.
+static bool store_compact(ParticleStore& s) {
+    if (s.n_dead == 0) return false;
+#ifdef _OPENMP
+    const int nt = omp_get_max_threads();
+#else
+    const int nt = 1;
+#endif
+    const int n = s.n;
+    s.counts.assign(nt + 1, 0);
+    s.gather.resize(n - s.n_dead);
+    const size_t free0 = s.free_ids.size();
+    s.free_ids.resize(free0 + s.n_dead);
+
+    #pragma omp parallel num_threads(nt)
+    {
+#ifdef _OPENMP
+        const int tid = omp_get_thread_num();
+        const int nth = omp_get_num_threads();
+#else
+        const int tid = 0, nth = 1;
+#endif
+        const int b = (int)((int64_t)n * tid / nth), e = (int)((int64_t)n * (tid + 1) / nth);
+        int c = 0;
+        for (int i = b; i < e; ++i) c += s.alive[i];
+        s.counts[tid + 1] = c;
+
+        #pragma omp barrier
+        #pragma omp single
+        for (int t = 0; t < nth; ++t) s.counts[t + 1] += s.counts[t];
+
+        // Slots before b hold counts[tid] live particles; the rest are dead.
+        int    out  = s.counts[tid];
+        size_t dead = free0 + (size_t)(b - s.counts[tid]);
+        for (int i = b; i < e; ++i) {
+            if (s.alive[i]) {
+                s.gather[out++] = (uint32_t)i;
+            } else {
+                ++s.gen[s.id[i]];
+                s.free_ids[dead++] = s.id[i];
+            }
+        }
+    }
+
+    std::vector<ParticlesSoA::Field> fs = s.p.fields();
+    for (size_t f = 0; f < fs.size(); ++f) store_apply(s, *fs[f].data, s.arena);
+    store_apply(s, s.id, s.id_scratch);
+
+    s.n      = (int)s.gather.size();
+    s.n_dead = 0;
+    s.alive.assign(s.n, 1);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < s.n; ++k) s.slot[s.id[k]] = (uint32_t)k;
+    return true;
+}
+
+// Compact once tombstones exceed max_dead of the slots. Returns true if it did.
+static bool store_maybe_compact(ParticleStore& s, float max_dead) {
+    if (s.n_dead <= max_dead * s.n) return false;
+    return store_compact(s);
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "galaxy_init.h"
+
+// ----------------------------------------------------------------------------
+// Out-of-core particle store for kinematic updates larger than RAM.
+//
+// The store is a checkpoint file (checkpoint.h) with layout
+// CHECKPOINT_LAYOUT_STREAM that holds only the six hot fields x, y, z, vx,
+// vy, vz. The cold fields are never touched by the drift, so they are not
+// stored. Each field is one page-aligned block, so a chunk of particles
+// [first, first + chunk) is six page-aligned windows of the file.
+//
+// stream_for_each_chunk visits the particles chunk by chunk:
+//
+//   for each chunk c:
+//     posix_fadvise(WILLNEED) chunk c + 1     read-ahead while c is processed
+//     mmap the six windows of chunk c (MAP_SHARED), run the callback, munmap
+//     sync_file_range(WRITE) chunk c          start write-back now
+//     posix_fadvise(DONTNEED) chunk c - 2     drop written pages from the cache
+//
+// Resident memory is a few chunks no matter how large the file is, so the
+// run is bounded by disk bandwidth rather than RAM. The chunk size is
+// rounded to a multiple of 1024 particles (4 KiB of floats). Each window is
+// mapped from the page boundary at or below it, so the store works with any
+// kernel page size (4K, 16K or 64K on AArch64).
+//
+// The header's iteration field counts completed passes, so the store doubles
+// as its own checkpoint between passes. A pass updates the particles in
+// place, so a pass that is cut short leaves some chunks advanced and others
+// not, and nothing in the file tells which. stream_begin_pass therefore sets
+// CHECKPOINT_FLAG_DIRTY in the header, durably, before the first chunk is
+// written, and stream_set_iteration clears it once the pass is on disk. A
+// store that is still dirty cannot be resumed.
+// ----------------------------------------------------------------------------
+
+static const int         STREAM_N_FIELDS = 6;
+static const char* const STREAM_FIELDS[STREAM_N_FIELDS] = { "x", "y", "z", "vx", "vy", "vz" };
+static const uint64_t    STREAM_CHUNK_GRAIN = CHECKPOINT_ALIGN / sizeof(float);
+
+struct ParticleStream {
+    int      fd = -1;
+    bool     writable = false;
+    uint64_t n = 0;
+    int64_t  iteration = 0;
+    uint64_t seed = 0;
+    bool     dirty = false;             // a pass was cut short
+    uint64_t offset[STREAM_N_FIELDS];   // byte offset of each field block
+    uint64_t chunk = 1 << 20;           // particles per chunk
+};
+
+static void stream_set_chunk(ParticleStream& s, uint64_t chunk) {
+    if (chunk < STREAM_CHUNK_GRAIN) chunk = STREAM_CHUNK_GRAIN;
+    s.chunk = (chunk + STREAM_CHUNK_GRAIN - 1) / STREAM_CHUNK_GRAIN * STREAM_CHUNK_GRAIN;
+}
+
+static void stream_close(ParticleStream& s) {
+    if (s.fd >= 0) close(s.fd);
+    s.fd = -1;
+}
+
+// Visit every chunk. f(first, count, x, y, z, vx, vy, vz) gets pointers into
+// the mapped file; with a writable stream, its stores go to disk.
+template <typename F>
+static bool stream_for_each_chunk(ParticleStream& s, F f) {
+    const uint64_t n_chunks = (s.n + s.chunk - 1) / s.chunk;
+    const int      prot     = s.writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    const uint64_t page     = (uint64_t)sysconf(_SC_PAGESIZE);
+
+    auto advise = [&](uint64_t c, int advice) {
+        if (c >= n_chunks) return;
+        const uint64_t count = std::min(s.chunk, s.n - c * s.chunk);
+        for (int k = 0; k < STREAM_N_FIELDS; ++k)
+            posix_fadvise(s.fd, (off_t)(s.offset[k] + c * s.chunk * sizeof(float)),
+                          (off_t)(count * sizeof(float)), advice);
+    };
+
+    advise(0, POSIX_FADV_WILLNEED);
+    for (uint64_t c = 0; c < n_chunks; ++c) {
+        advise(c + 1, POSIX_FADV_WILLNEED);
+
+        const uint64_t first = c * s.chunk;
+        const uint64_t count = std::min(s.chunk, s.n - first);
+        const size_t   bytes = (size_t)(count * sizeof(float));
+        float* field[STREAM_N_FIELDS];
+        char*  base[STREAM_N_FIELDS];
+        size_t lead[STREAM_N_FIELDS];
+        bool ok = true;
+        for (int k = 0; k < STREAM_N_FIELDS; ++k) {
+            const uint64_t at = s.offset[k] + first * sizeof(float);
+            lead[k] = (size_t)(at % page);
+            void* m = mmap(nullptr, lead[k] + bytes, prot, MAP_SHARED, s.fd, (off_t)(at - lead[k]));
+            base[k]  = m == MAP_FAILED ? nullptr : static_cast<char*>(m);
+            field[k] = base[k] ? reinterpret_cast<float*>(base[k] + lead[k]) : nullptr;
+            ok = ok && field[k] != nullptr;
+        }
+        if (ok) f(first, count, field[0], field[1], field[2], field[3], field[4], field[5]);
+        for (int k = 0; k < STREAM_N_FIELDS; ++k)
+            if (base[k]) munmap(base[k], lead[k] + bytes);
+        if (!ok) {
+            fprintf(stderr, "stream: cannot map chunk %llu\n", (unsigned long long)c);
+            return false;
+        }
+
+        if (s.writable) {
+            for (int k = 0; k < STREAM_N_FIELDS; ++k)
+                sync_file_range(s.fd, (off_t)(s.offset[k] + first * sizeof(float)),
+                                (off_t)bytes, SYNC_FILE_RANGE_WRITE);
+        }
+        if (c >= 2) advise(c - 2, POSIX_FADV_DONTNEED);
+    }
+    if (n_chunks >= 2) advise(n_chunks - 2, POSIX_FADV_DONTNEED);
+    if (n_chunks >= 1) advise(n_chunks - 1, POSIX_FADV_DONTNEED);
+    return true;
+}
+
+static bool stream_write_flags(ParticleStream& s, uint32_t flags) {
+    const off_t off = (off_t)offsetof(CheckpointHeader, flags);
+    return checkpoint_write_all(s.fd, &flags, sizeof(flags), (uint64_t)off);
+}
+
+// Mark the store dirty before a pass writes to it. The flag is on disk
+// before any particle data of the pass can be.
+static bool stream_begin_pass(ParticleStream& s) {
+    if (!stream_write_flags(s, CHECKPOINT_FLAG_DIRTY) || fdatasync(s.fd) != 0) {
+        fprintf(stderr, "stream: cannot update header\n");
+        return false;
+    }
+    s.dirty = true;
+    return true;
+}
+
+// Record completed passes in the header and clear the dirty flag, once the
+// pass itself is durable.
+static bool stream_set_iteration(ParticleStream& s, int64_t iteration) {
+    const off_t off = (off_t)offsetof(CheckpointHeader, iteration);
+    if (fdatasync(s.fd) != 0 ||
+        !checkpoint_write_all(s.fd, &iteration, sizeof(iteration), (uint64_t)off) ||
+        !stream_write_flags(s, 0) || fdatasync(s.fd) != 0) {
+        fprintf(stderr, "stream: cannot update header\n");
+        return false;
+    }
+    s.iteration = iteration;
+    s.dirty     = false;
+    return true;
+}
+
+// Open an existing store.
+static bool stream_open(ParticleStream& s, const char* path, bool writable) {
+    s.fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (s.fd < 0) {
+        fprintf(stderr, "stream: cannot open %s\n", path);
+        return false;
+    }
+    s.writable = writable;
+
+    std::vector<char> head(CHECKPOINT_ALIGN);
+    struct stat st;
+    bool ok = fstat(s.fd, &st) == 0 &&
+              pread(s.fd, head.data(), head.size(), 0) == (ssize_t)head.size();
+    const CheckpointHeader* h = reinterpret_cast<const CheckpointHeader*>(head.data());
+    const CheckpointFieldDesc* desc = reinterpret_cast<const CheckpointFieldDesc*>(h + 1);
+    ok = ok && memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) == 0 &&
+         h->version == CHECKPOINT_VERSION && h->layout == CHECKPOINT_LAYOUT_STREAM &&
+         h->n_fields == (uint32_t)STREAM_N_FIELDS;
+    for (int k = 0; ok && k < STREAM_N_FIELDS; ++k) {
+        ok = strncmp(desc[k].name, STREAM_FIELDS[k], sizeof(desc[k].name)) == 0 &&
+             desc[k].bytes == h->n_particles * sizeof(float) &&
+             desc[k].offset % CHECKPOINT_ALIGN == 0 &&
+             desc[k].offset + desc[k].bytes <= (uint64_t)st.st_size;
+        s.offset[k] = desc[k].offset;
+    }
+    if (!ok) {
+        fprintf(stderr, "stream: %s is not a particle stream store\n", path);
+        stream_close(s);
+        return false;
+    }
+    s.n         = h->n_particles;
+    s.iteration = h->iteration;
+    s.seed      = h->rng_state;
+    s.dirty     = (h->flags & CHECKPOINT_FLAG_DIRTY) != 0;
+    return true;
+}
+
+// Create a store of n galaxy particles, initialised chunk by chunk from the
+// counter-based generator (galaxy_init.h), so the contents match
+// init_galaxy exactly for any n. Written to "<path>.tmp" and renamed into
+// place once complete.
+static bool stream_create(ParticleStream& s, const char* path, uint64_t n, uint64_t seed) {
+    std::vector<char> head(CHECKPOINT_ALIGN, 0);
+    CheckpointHeader* h = reinterpret_cast<CheckpointHeader*>(head.data());
+    CheckpointFieldDesc* desc = reinterpret_cast<CheckpointFieldDesc*>(h + 1);
+    memcpy(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic));
+    h->version     = CHECKPOINT_VERSION;
+    h->layout      = CHECKPOINT_LAYOUT_STREAM;
+    h->n_particles = n;
+    h->iteration   = 0;
+    h->rng_state   = seed;
+    h->n_fields    = STREAM_N_FIELDS;
+
+    uint64_t off = CHECKPOINT_ALIGN;
+    for (int k = 0; k < STREAM_N_FIELDS; ++k) {
+        strncpy(desc[k].name, STREAM_FIELDS[k], sizeof(desc[k].name) - 1);
+        desc[k].offset = off;
+        desc[k].bytes  = n * sizeof(float);
+        s.offset[k]    = off;
+        off = checkpoint_align_up(off + desc[k].bytes);
+    }
+
+    const std::string tmp = std::string(path) + ".tmp";
+    s.fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (s.fd < 0) {
+        fprintf(stderr, "stream: cannot create %s\n", tmp.c_str());
+        return false;
+    }
+    s.writable  = true;
+    s.n         = n;
+    s.iteration = 0;
+    s.seed      = seed;
+
+    bool ok = checkpoint_write_all(s.fd, head.data(), head.size(), 0) &&
+              ftruncate(s.fd, (off_t)off) == 0;
+    ok = ok && stream_for_each_chunk(s, [&](uint64_t first, uint64_t count,
+                                            float* x, float* y, float* z,
+                                            float* vx, float* vy, float* vz) {
+        #pragma omp parallel for schedule(static)
+        for (int64_t k = 0; k < (int64_t)count; ++k) {
+            GalaxyParticle g = galaxy_particle(seed, first + (uint64_t)k);
+            x[k]  = g.x;  y[k]  = g.y;  z[k]  = g.z;
+            vx[k] = g.vx; vy[k] = g.vy; vz[k] = g.vz;
+        }
+    });
+    ok = ok && fsync(s.fd) == 0 && rename(tmp.c_str(), path) == 0;
+    if (!ok) {
+        fprintf(stderr, "stream: failed to write %s\n", path);
+        stream_close(s);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "galaxy_init.h"
+
+// Array-of-Structures layout.
+// Each ParticleAoS is exactly 64 bytes — one full cache line.
+// The hot position-update loop only reads/writes x, y, z, vx, vy, vz
+// (6 floats = 24 bytes), so 40 of the 64 bytes loaded per particle are wasted.
+//
+// Shared by aos_baseline and particle_bench.
+struct ParticleAoS {
+    float x, y, z;                   // position      (12 bytes) — used in hot loop
+    float vx, vy, vz;                // velocity      (12 bytes) — used in hot loop
+    float mass, charge, temperature; // properties    (12 bytes) — not used in hot loop
+    float pressure, energy, density; //               (12 bytes) — not used in hot loop
+    float spin_x, spin_y, spin_z;    //               (12 bytes) — not used in hot loop
+    float pad;                        // padding        (4 bytes)
+    // Total: 64 bytes = 1 cache line. Hot loop uses 24 / 64 = 37.5%.
+};
+
+static_assert(sizeof(ParticleAoS) == 64, "ParticleAoS must be one cache line");
+
+// Initialise particles as a four-arm logarithmic spiral galaxy.
+// Particles are placed on spiral arms with a flat rotation curve so that
+// differential rotation slowly winds the arms further during the simulation.
+// Each particle depends only on (seed, i) — see galaxy_init.h — so the loop
+// is split across threads without changing the result.
+static void init_galaxy(ParticleAoS* p, int n, uint64_t seed) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        GalaxyParticle g = galaxy_particle(seed, (uint32_t)i);
+        p[i].x  = g.x;  p[i].y  = g.y;  p[i].z  = g.z;
+        p[i].vx = g.vx; p[i].vy = g.vy; p[i].vz = g.vz;
+
+        // Cold fields — present in the struct but never touched by update_positions.
+        p[i].mass        = 1.0f;
+        p[i].charge      = 0.5f;
+        p[i].temperature = 300.0f;
+        p[i].pressure    = 101325.0f;
+        p[i].energy      = 0.0f;
+        p[i].density     = 1.0f;
+        p[i].spin_x      = 0.0f;
+        p[i].spin_y      = 0.0f;
+        p[i].spin_z      = 0.0f;
+        p[i].pad         = 0.0f;
+    }
+}
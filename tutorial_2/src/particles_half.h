@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "particles_soa.h"
+#include "reorder.h"
+
+// ----------------------------------------------------------------------------
+// Reduced-precision storage for the hot particle fields.
+//
+// update_positions is bandwidth-bound: per particle it streams 24 bytes in
+// and 12 out. Storing fields as 16-bit floats and converting to FP32 in
+// registers cuts that traffic:
+//
+//   velocities only         x, y, z fp32 + vx, vy, vz 16-bit   18 B/particle
+//   + positions             x, y, z 16-bit offsets too          12 B/particle
+//
+// Two 16-bit formats:
+//   FP16  IEEE binary16: 11-bit significand, range +-65504
+//   BF16  top half of a float32: 8-bit significand, full float range
+//
+// Positions cannot be stored as absolute 16-bit values. An FP16 coordinate
+// near 8 is quantised to 2^-7, coarser than a whole step of motion. So they
+// are stored as offsets from a per-block origin. The particles are first
+// sorted along a Morton curve (reorder.h), so each block of HALF_BLOCK
+// consecutive particles is spatially compact and its offsets stay small.
+// As the particles move their offsets grow and lose precision. Every
+// HALF_RECENTRE_EVERY steps each block origin is therefore moved to the
+// centre of its particles and the offsets are rewritten around it. A block
+// still spreads out over time (its particles orbit at different speeds), so
+// some error accumulates. The drift against the FP32 run is what this mode
+// reports.
+//
+// Position offsets need FP16. A BF16 offset of a few units has an 8-bit
+// significand, coarser than one step of motion, so particles stall; callers
+// reject BF16 with half_positions.
+//
+// On AArch64 the conversions compile to FCVT (vectorised), and only there do
+// the saved bytes turn into speed. Elsewhere FP16 uses branch-free integer
+// code that still vectorises but costs more than the bytes it saves.
+// ----------------------------------------------------------------------------
+
+enum HalfFormat {
+    HALF_FP16 = 0,
+    HALF_BF16 = 1,
+};
+
+static const int HALF_BLOCK          = 256;  // particles sharing one position origin
+static const int HALF_RECENTRE_EVERY = 16;   // steps between origin updates
+
+static inline uint32_t half_bits(float f) { uint32_t u; memcpy(&u, &f, 4); return u; }
+static inline float    half_float(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+
+static inline uint16_t f32_to_bf16(float f) {
+    const uint32_t u = half_bits(f);
+    return (uint16_t)((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);   // round to nearest even
+}
+
+static inline float bf16_to_f32(uint16_t h) { return half_float((uint32_t)h << 16); }
+
+#if defined(__aarch64__)
+static inline uint16_t f32_to_fp16(float f) {
+    __fp16 h = (__fp16)f;
+    uint16_t u; memcpy(&u, &h, 2);
+    return u;
+}
+static inline float fp16_to_f32(uint16_t u) {
+    __fp16 h; memcpy(&h, &u, 2);
+    return (float)h;
+}
+#else
+// Round-to-nearest-even float -> binary16. Overflow goes to infinity, tiny
+// values to signed zero or subnormals.
+static inline uint16_t f32_to_fp16(float f) {
+    uint32_t u = half_bits(f);
+    const uint32_t sign = (u >> 16) & 0x8000u;
+    u &= 0x7fffffffu;
+
+    // Normal range: rebias the exponent and round the low 13 bits away.
+    const uint32_t normal = (u + 0xfffu + ((u >> 13) & 1u) - (112u << 23)) >> 13;
+    // Subnormal range: add 0.5 as a float so the FPU shifts and rounds.
+    const uint32_t sub = half_bits(half_float(u) + 0.5f) - 0x3f000000u;
+    const uint32_t inf = 0x7c00u | ((uint32_t)(u > 0x7f800000u) << 9);   // NaN stays NaN
+
+    // Select with masks rather than ?: so the loops calling this have no
+    // control flow and vectorise.
+    const uint32_t is_big = 0u - (uint32_t)(u >= 0x47800000u);
+    const uint32_t is_sub = 0u - (uint32_t)(u <  0x38800000u);
+    const uint32_t h = (is_big & inf) | (~is_big & is_sub & sub) | (~is_big & ~is_sub & normal);
+    return (uint16_t)(sign | h);
+}
+
+static inline float fp16_to_f32(uint16_t h) {
+    const uint32_t magic_sub = 113u << 23;
+    uint32_t o = ((uint32_t)h & 0x7fffu) << 13;
+    const uint32_t exp = o & (0x7c00u << 13);
+    o += (127u - 15u) << 23;
+    // Inf/NaN: push the exponent the rest of the way to 255.
+    const uint32_t o_inf = o + ((128u - 16u) << 23);
+    // Subnormal: renormalise through the FPU.
+    const uint32_t o_sub = half_bits(half_float(o + (1u << 23)) - half_float(magic_sub));
+    const uint32_t is_inf = 0u - (uint32_t)(exp == (0x7c00u << 13));
+    const uint32_t is_sub = 0u - (uint32_t)(exp == 0);
+    o = (is_inf & o_inf) | (is_sub & o_sub) | (~is_inf & ~is_sub & o);
+    return half_float(o | ((uint32_t)h & 0x8000u) << 16);
+}
+#endif
+
+template <int FMT> static inline uint16_t half_pack(float f);
+template <int FMT> static inline float    half_unpack(uint16_t h);
+template <> inline uint16_t half_pack<HALF_FP16>(float f)    { return f32_to_fp16(f); }
+template <> inline uint16_t half_pack<HALF_BF16>(float f)    { return f32_to_bf16(f); }
+template <> inline float    half_unpack<HALF_FP16>(uint16_t h) { return fp16_to_f32(h); }
+template <> inline float    half_unpack<HALF_BF16>(uint16_t h) { return bf16_to_f32(h); }
+
+struct ParticlesHalf {
+    HalfFormat            format = HALF_FP16;
+    bool                  half_positions = false;
+    int                   n = 0;
+    int                   steps = 0;       // updates since the last recentre
+    std::vector<float>    x, y, z;         // fp32 positions (velocity-only mode)
+    std::vector<uint16_t> hx, hy, hz;      // position offsets (half_positions)
+    std::vector<float>    ox, oy, oz;      // per-block origins (half_positions)
+    std::vector<uint16_t> vx, vy, vz;
+    std::vector<uint32_t> perm;            // particle k came from FP32 particle perm[k]
+
+    int bytes_per_particle() const { return (half_positions ? 6 : 12) + 6; }
+};
+
+static inline uint16_t half_pack_rt(HalfFormat f, float v) {
+    return f == HALF_FP16 ? f32_to_fp16(v) : f32_to_bf16(v);
+}
+static inline float half_unpack_rt(HalfFormat f, uint16_t h) {
+    return f == HALF_FP16 ? fp16_to_f32(h) : bf16_to_f32(h);
+}
+
+// Pick block b's origin as the centre of its particles' box and store their
+// absolute positions as offsets from it. x/y/z[j] is the block's j-th particle.
+static void half_set_block(ParticlesHalf& h, int b, const float* x, const float* y,
+                           const float* z) {
+    const int k0 = b * HALF_BLOCK, k1 = std::min(h.n, k0 + HALF_BLOCK);
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (int k = k0; k < k1; ++k) {
+        const int j = k - k0;
+        lo[0] = std::min(lo[0], x[j]); hi[0] = std::max(hi[0], x[j]);
+        lo[1] = std::min(lo[1], y[j]); hi[1] = std::max(hi[1], y[j]);
+        lo[2] = std::min(lo[2], z[j]); hi[2] = std::max(hi[2], z[j]);
+    }
+    h.ox[b] = 0.5f * (lo[0] + hi[0]);
+    h.oy[b] = 0.5f * (lo[1] + hi[1]);
+    h.oz[b] = 0.5f * (lo[2] + hi[2]);
+    for (int k = k0; k < k1; ++k) {
+        const int j = k - k0;
+        h.hx[k] = half_pack_rt(h.format, x[j] - h.ox[b]);
+        h.hy[k] = half_pack_rt(h.format, y[j] - h.oy[b]);
+        h.hz[k] = half_pack_rt(h.format, z[j] - h.oz[b]);
+    }
+}
+
+// Build the reduced-precision copy of the first n particles of p.
+static void half_from_soa(ParticlesHalf& h, const ParticlesSoA& p, int n,
+                          HalfFormat format, bool half_positions) {
+    h.format         = format;
+    h.half_positions = half_positions;
+    h.n              = n;
+    h.perm.resize(n);
+
+    if (half_positions) {
+        Reorder r;
+        reorder_compute(r, p, n, REORDER_MORTON);
+        h.perm = r.perm;
+    } else {
+        for (int i = 0; i < n; ++i) h.perm[i] = (uint32_t)i;
+    }
+
+    h.vx.resize(n); h.vy.resize(n); h.vz.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = h.perm[k];
+        h.vx[k] = half_pack_rt(format, p.vx[i]);
+        h.vy[k] = half_pack_rt(format, p.vy[i]);
+        h.vz[k] = half_pack_rt(format, p.vz[i]);
+    }
+
+    if (!half_positions) {
+        h.x = p.x; h.y = p.y; h.z = p.z;
+        h.x.resize(n); h.y.resize(n); h.z.resize(n);
+        return;
+    }
+
+    const int n_blocks = (n + HALF_BLOCK - 1) / HALF_BLOCK;
+    h.ox.resize(n_blocks); h.oy.resize(n_blocks); h.oz.resize(n_blocks);
+    h.hx.resize(n); h.hy.resize(n); h.hz.resize(n);
+    std::vector<float> x(n), y(n), z(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        x[k] = p.x[h.perm[k]]; y[k] = p.y[h.perm[k]]; z[k] = p.z[h.perm[k]];
+    }
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < n_blocks; ++b)
+        half_set_block(h, b, x.data() + b * HALF_BLOCK, y.data() + b * HALF_BLOCK,
+                       z.data() + b * HALF_BLOCK);
+}
+
+// Absolute FP32 position of particle k (in the copy's order).
+static inline void half_position(const ParticlesHalf& h, int k, float& x, float& y, float& z) {
+    if (!h.half_positions) {
+        x = h.x[k]; y = h.y[k]; z = h.z[k];
+        return;
+    }
+    const int b = k / HALF_BLOCK;
+    x = h.ox[b] + half_unpack_rt(h.format, h.hx[k]);
+    y = h.oy[b] + half_unpack_rt(h.format, h.hy[k]);
+    z = h.oz[b] + half_unpack_rt(h.format, h.hz[k]);
+}
+
+// Move every block origin to the current centre of its particles.
+static void half_recentre(ParticlesHalf& h) {
+    const int n_blocks = (int)h.ox.size();
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < n_blocks; ++b) {
+        float x[HALF_BLOCK], y[HALF_BLOCK], z[HALF_BLOCK];
+        const int k0 = b * HALF_BLOCK, k1 = std::min(h.n, k0 + HALF_BLOCK);
+        for (int k = k0; k < k1; ++k)
+            half_position(h, k, x[k - k0], y[k - k0], z[k - k0]);
+        half_set_block(h, b, x, y, z);
+    }
+    h.steps = 0;
+}
+
+// The drift of update_positions for particles [i0, i1) with 16-bit storage:
+// load, widen to FP32, update in registers, narrow on store. `omp simd`
+// because GCC's -O2 cost model would otherwise leave the widening loops
+// scalar; galaxy_drift keeps the plain -O2 flags.
+template <int FMT>
+static void half_update_range(ParticlesHalf& h, float dt, int i0, int i1) {
+    const uint16_t* vx = h.vx.data();
+    const uint16_t* vy = h.vy.data();
+    const uint16_t* vz = h.vz.data();
+    if (!h.half_positions) {
+        float* x = h.x.data();
+        float* y = h.y.data();
+        float* z = h.z.data();
+        #pragma omp simd
+        for (int i = i0; i < i1; ++i) {
+            x[i] += half_unpack<FMT>(vx[i]) * dt;
+            y[i] += half_unpack<FMT>(vy[i]) * dt;
+            z[i] += half_unpack<FMT>(vz[i]) * dt;
+        }
+        return;
+    }
+    uint16_t* x = h.hx.data();
+    uint16_t* y = h.hy.data();
+    uint16_t* z = h.hz.data();
+    #pragma omp simd
+    for (int i = i0; i < i1; ++i) {
+        x[i] = half_pack<FMT>(half_unpack<FMT>(x[i]) + half_unpack<FMT>(vx[i]) * dt);
+        y[i] = half_pack<FMT>(half_unpack<FMT>(y[i]) + half_unpack<FMT>(vy[i]) * dt);
+        z[i] = half_pack<FMT>(half_unpack<FMT>(z[i]) + half_unpack<FMT>(vz[i]) * dt);
+    }
+}
+
+static inline void half_update_positions(ParticlesHalf& h, float dt) {
+    if (h.format == HALF_FP16) half_update_range<HALF_FP16>(h, dt, 0, h.n);
+    else                       half_update_range<HALF_BF16>(h, dt, 0, h.n);
+    if (h.half_positions && ++h.steps == HALF_RECENTRE_EVERY) half_recentre(h);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "galaxy_init.h"
+
+// Structure-of-Arrays layout.
+// The hot position-update loop only touches the x, y, z, vx, vy, vz arrays.
+// Working set for those 6 arrays = 6 * 4 MB = 24 MB — fits in L3 on Graviton3.
+// Every byte loaded from those arrays is useful data: 100% cache line utilisation.
+//
+// Shared by soa_optimized and the engine programs (galaxy_nbody, ...), so
+// every stage that operates on particles sees the same hot/cold split.
+struct ParticlesSoA {
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    // Remaining fields exist but live in separate allocations and are never
+    // touched by update_positions, so they do not pollute the hot cache lines.
+    std::vector<float> mass, charge, temperature;
+    std::vector<float> pressure, energy, density;
+    std::vector<float> spin_x, spin_y, spin_z;
+
+    struct Field {
+        const char*         name;
+        std::vector<float>* data;
+    };
+
+    // Every array, hot fields first, in a fixed order. Passes that must treat
+    // all fields alike (checkpointing, reordering) iterate over this list.
+    std::vector<Field> fields() {
+        Field f[] = {
+            { "x", &x },                     { "y", &y },
+            { "z", &z },                     { "vx", &vx },
+            { "vy", &vy },                   { "vz", &vz },
+            { "mass", &mass },               { "charge", &charge },
+            { "temperature", &temperature }, { "pressure", &pressure },
+            { "energy", &energy },           { "density", &density },
+            { "spin_x", &spin_x },           { "spin_y", &spin_y },
+            { "spin_z", &spin_z },
+        };
+        return std::vector<Field>(f, f + sizeof(f) / sizeof(f[0]));
+    }
+
+    size_t size() const { return x.size(); }
+
+    void resize(size_t n) {
+        std::vector<Field> fs = fields();
+        for (size_t k = 0; k < fs.size(); ++k) fs[k].data->resize(n);
+    }
+};
+
+// Particle i from galaxy_init state plus the default cold fields. Also used
+// to fill particles inserted at run time (particle_store.h).
+static inline void soa_set_particle(ParticlesSoA& p, size_t i, const GalaxyParticle& g) {
+    p.x[i]  = g.x;  p.y[i]  = g.y;  p.z[i]  = g.z;
+    p.vx[i] = g.vx; p.vy[i] = g.vy; p.vz[i] = g.vz;
+
+    p.mass[i]        = 1.0f;
+    p.charge[i]      = 0.5f;
+    p.temperature[i] = 300.0f;
+    p.pressure[i]    = 101325.0f;
+    p.energy[i]      = 0.0f;
+    p.density[i]     = 1.0f;
+    p.spin_x[i]      = 0.0f;
+    p.spin_y[i]      = 0.0f;
+    p.spin_z[i]      = 0.0f;
+}
+
+// Initialise particles as a four-arm logarithmic spiral galaxy.
+// Identical initial conditions to aos_baseline — only the data layout differs.
+static void init_galaxy(ParticlesSoA& p, int n, uint64_t seed) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i)
+        soa_set_particle(p, (size_t)i, galaxy_particle(seed, (uint32_t)i));
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// ----------------------------------------------------------------------------
+// Parallel LSD radix sort of records with a uint64_t `key` member.
+//
+// 8-bit digits, one pass per digit. Each pass:
+//   1. every thread counts digits in its static chunk,
+//   2. one thread turns the (digit, thread) counts into write offsets,
+//   3. every thread scatters its chunk, in order, to those offsets.
+// Each pass is stable, so records with equal keys keep their input order.
+// If every key has the same digit in a pass, that pass is skipped, so keys
+// that only use their low bits cost fewer passes.
+// ----------------------------------------------------------------------------
+
+static const int RADIX_BITS    = 8;
+static const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+// Sort a[0, n) by key, looking at the low key_bits bits. tmp must hold n
+// records; the result always ends up in a.
+template <typename T>
+static void radix_sort_by_key(T* a, T* tmp, size_t n, int key_bits) {
+    if (n < 2) return;
+#ifdef _OPENMP
+    const int nt = omp_get_max_threads();
+#else
+    const int nt = 1;
+#endif
+    std::vector<size_t> hist((size_t)nt * RADIX_BUCKETS);
+    T* src = a;
+    T* dst = tmp;
+
+    for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+        bool skip = false;
+        #pragma omp parallel num_threads(nt)
+        {
+#ifdef _OPENMP
+            const int tid = omp_get_thread_num();
+            const int nth = omp_get_num_threads();
+#else
+            const int tid = 0, nth = 1;
+#endif
+            const size_t b = n * tid / nth, e = n * (tid + 1) / nth;
+            size_t* h = &hist[(size_t)tid * RADIX_BUCKETS];
+            memset(h, 0, RADIX_BUCKETS * sizeof(size_t));
+            for (size_t i = b; i < e; ++i) ++h[(src[i].key >> shift) & (RADIX_BUCKETS - 1)];
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                size_t sum = 0;
+                for (int d = 0; d < RADIX_BUCKETS; ++d) {
+                    size_t in_digit = 0;
+                    for (int t = 0; t < nth; ++t) {
+                        size_t& c = hist[(size_t)t * RADIX_BUCKETS + d];
+                        const size_t count = c;
+                        c = sum;
+                        sum += count;
+                        in_digit += count;
+                    }
+                    if (in_digit == n) skip = true;
+                }
+            }
+
+            if (!skip) {
+                for (size_t i = b; i < e; ++i)
+                    dst[h[(src[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+            }
+        }
+        if (!skip) std::swap(src, dst);
+    }
+    if (src != a) memcpy(a, src, n * sizeof(T));
+}
+
+template <typename T>
+static void radix_sort_by_key(std::vector<T>& a, std::vector<T>& tmp, int key_bits) {
+    tmp.resize(a.size());
+    radix_sort_by_key(a.data(), tmp.data(), a.size(), key_bits);
+}
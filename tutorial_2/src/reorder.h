@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "barnes_hut.h"
+#include "particles_soa.h"
+#include "radix_sort.h"
+
+// ----------------------------------------------------------------------------
+// Space-filling-curve reordering of the particle arrays.
+//
+// init_galaxy emits particles arm by arm (i % 4), so neighbours in space are
+// far apart in memory. Every stage that visits particles near each other
+// (tree build gathers, neighbour search, SPH) then misses cache on nearly
+// every particle. This pass sorts the particles along a Morton or Hilbert
+// curve and permutes every SoA array, hot and cold, into that order:
+//
+//   1. quantise x/y/z on the bounding cube (same grid as the Barnes–Hut keys),
+//   2. 63-bit curve key per particle, parallel radix sort of (key, index),
+//   3. gather each field through the permutation into one scratch arena, then
+//      swap the arena with the field, so the old storage becomes the arena for
+//      the next field. This needs one extra array, not fifteen.
+//
+// Hilbert order has no jumps between octants, so consecutive particles are
+// always spatial neighbours. Morton keys are cheaper and match the tree.
+// Per-particle state kept outside ParticlesSoA (integrator bins,
+// accelerations) must be permuted with reorder_apply using the same Reorder.
+// ----------------------------------------------------------------------------
+
+enum ReorderCurve {
+    REORDER_MORTON  = 0,
+    REORDER_HILBERT = 1,
+};
+
+struct Reorder {
+    std::vector<BHKey>    keys, scratch;
+    std::vector<uint32_t> perm;    // new position k holds old particle perm[k]
+    std::vector<float>    arena;   // gather target, swapped with each field in turn
+};
+
+// 3-D Hilbert key from 21-bit grid coordinates (Skilling, "Programming the
+// Hilbert curve", 2004): convert axes to the transposed Hilbert index in
+// place, then interleave the bits with x most significant.
+static inline uint64_t reorder_hilbert(uint64_t q[3]) {
+    const uint64_t M = (uint64_t)1 << (BH_KEY_LEVELS - 1);
+    for (uint64_t Q = M; Q > 1; Q >>= 1) {
+        const uint64_t P = Q - 1;
+        for (int i = 0; i < 3; ++i) {
+            if (q[i] & Q) {
+                q[0] ^= P;
+            } else {
+                const uint64_t t = (q[0] ^ q[i]) & P;
+                q[0] ^= t;
+                q[i] ^= t;
+            }
+        }
+    }
+    q[1] ^= q[0];
+    q[2] ^= q[1];
+    uint64_t t = 0;
+    for (uint64_t Q = M; Q > 1; Q >>= 1)
+        if (q[2] & Q) t ^= Q - 1;
+    for (int i = 0; i < 3; ++i) q[i] ^= t;
+    return bh_spread3(q[0]) << 2 | bh_spread3(q[1]) << 1 | bh_spread3(q[2]);
+}
+
+// Compute the permutation that sorts the first n particles along the curve.
+static void reorder_compute(Reorder& r, const ParticlesSoA& p, int n, ReorderCurve curve) {
+    float lo[3];
+    const float inv_size = 1.0f / bh_bounds(p, n, lo);
+
+    r.keys.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        uint64_t q[3];
+        bh_quantise(p.x[i], p.y[i], p.z[i], lo, inv_size, q);
+        r.keys[i].key = curve == REORDER_HILBERT
+                      ? reorder_hilbert(q)
+                      : bh_spread3(q[0]) << 2 | bh_spread3(q[1]) << 1 | bh_spread3(q[2]);
+        r.keys[i].index = (uint32_t)i;
+    }
+    radix_sort_by_key(r.keys, r.scratch, 3 * BH_KEY_LEVELS);
+
+    r.perm.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) r.perm[k] = r.keys[k].index;
+}
+
+// Permute one array by the last computed permutation, via scratch.
+template <typename T>
+static void reorder_apply(const Reorder& r, std::vector<T>& data, std::vector<T>& scratch) {
+    const int n = (int)r.perm.size();
+    scratch.resize(data.size());
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) scratch[k] = data[r.perm[k]];
+    for (size_t k = n; k < data.size(); ++k) scratch[k] = data[k];
+    std::swap(data, scratch);
+}
+
+// Sort the particles along the curve and permute every field of p.
+static inline void reorder_particles(Reorder& r, ParticlesSoA& p, int n, ReorderCurve curve) {
+    reorder_compute(r, p, n, curve);
+    std::vector<ParticlesSoA::Field> fs = p.fields();
+    for (size_t f = 0; f < fs.size(); ++f) reorder_apply(r, *fs[f].data, r.arena);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "snapshot_codec.h"
+
+// ----------------------------------------------------------------------------
+// Seekable snapshot file format used by --visualize (version 2).
+//
+// The original format was two ints followed by raw frames, so readers had to
+// walk the whole file and a crash mid-run left it unreadable. Version 2 adds
+// a fixed-size frame index after the file header, so any frame can be found
+// (or mmap'ed) without touching the others:
+//
+//   offset 0     SnapshotFileHeader     (64 bytes)
+//   offset 64    SnapshotIndexEntry[max_frames]
+//   ...          padding to SNAPSHOT_ALIGN
+//   frame k      SnapshotFrameHeader    (64 bytes, frame start is page aligned)
+//                payload                (64-byte aligned, codec-dependent)
+//
+// Raw payload (SNAPSHOT_CODEC_RAW): n_particles float32 x, then y, then z.
+// Compressed payload (SNAPSHOT_CODEC_QDELTA): see snapshot_codec.h.
+//
+// Frames are appended in three steps: payload, then its index entry, then the
+// n_frames count in the file header. If the process dies part-way through a
+// frame, the header still describes every frame that was fully written.
+// All integers are little-endian.
+// ----------------------------------------------------------------------------
+
+static const char     SNAPSHOT_MAGIC[8]     = { 'G', 'A', 'L', 'S', 'N', 'A', 'P', '\0' };
+static const uint32_t SNAPSHOT_VERSION      = 2;
+static const uint32_t SNAPSHOT_ALIGN        = 4096;        // page size: frames can be mmap'ed
+static const uint32_t SNAPSHOT_FRAME_MAGIC  = 0x454d5246u; // "FRME"
+static const uint32_t SNAPSHOT_CODEC_RAW    = 0;           // float32 x[], y[], z[]
+static const uint32_t SNAPSHOT_CODEC_QDELTA = 1;           // see snapshot_codec.h
+
+struct SnapshotFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t alignment;       // every frame starts on a multiple of this
+    uint32_t max_frames;      // capacity of the index table
+    uint32_t n_frames;        // frames fully written so far
+    uint64_t index_offset;    // byte offset of SnapshotIndexEntry[0]
+    uint32_t reserved[8];
+};
+
+struct SnapshotIndexEntry {
+    uint64_t offset;          // byte offset of the frame's SnapshotFrameHeader
+    uint64_t bytes;           // frame header + payload
+};
+
+struct SnapshotFrameHeader {
+    uint32_t magic;           // SNAPSHOT_FRAME_MAGIC
+    uint32_t codec;           // SNAPSHOT_CODEC_*
+    int64_t  iteration;       // simulation step the frame was taken after
+    double   sim_time;        // iteration * dt
+    uint32_t n_particles;     // particles stored in this frame
+    uint32_t stride;          // 1-in-stride subsampling of the full particle set
+    uint64_t payload_bytes;
+    uint32_t reserved[6];
+};
+
+static_assert(sizeof(SnapshotFileHeader)  == 64, "snapshot file header must be 64 bytes");
+static_assert(sizeof(SnapshotIndexEntry)  == 16, "snapshot index entry must be 16 bytes");
+static_assert(sizeof(SnapshotFrameHeader) == 64, "snapshot frame header must be 64 bytes");
+
+static inline uint64_t snapshot_align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+struct SnapshotWriter {
+    int                  fd         = -1;
+    uint32_t             max_frames = 0;
+    uint32_t             n_frames   = 0;
+    uint64_t             end        = 0;   // next free (aligned) byte offset
+    uint32_t             codec      = SNAPSHOT_CODEC_RAW;
+    std::vector<float>   gather;           // x|y|z staging buffer for one frame
+    QDeltaEncoder        encoder;          // SNAPSHOT_CODEC_QDELTA state
+    std::vector<uint8_t> encoded;          // SNAPSHOT_CODEC_QDELTA output buffer
+};
+
+static bool snapshot_pwrite(int fd, const void* src, size_t n, uint64_t off) {
+    const char* p = static_cast<const char*>(src);
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, (off_t)off);
+        if (w <= 0) return false;
+        p += w; n -= (size_t)w; off += (uint64_t)w;
+    }
+    return true;
+}
+
+// Create (or truncate) a snapshot file with room for max_frames frames.
+static bool snapshot_open(SnapshotWriter& w, const char* path, uint32_t max_frames,
+                          uint32_t codec = SNAPSHOT_CODEC_RAW) {
+    w.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0) {
+        fprintf(stderr, "snapshot: cannot create %s\n", path);
+        return false;
+    }
+    w.max_frames = max_frames;
+    w.n_frames   = 0;
+    w.codec      = codec;
+
+    SnapshotFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version      = SNAPSHOT_VERSION;
+    h.alignment    = SNAPSHOT_ALIGN;
+    h.max_frames   = max_frames;
+    h.n_frames     = 0;
+    h.index_offset = sizeof(SnapshotFileHeader);
+
+    // Zeroed index: readers treat entries past n_frames as absent.
+    std::vector<SnapshotIndexEntry> index(max_frames);
+    memset(index.data(), 0, index.size() * sizeof(SnapshotIndexEntry));
+
+    w.end = snapshot_align_up(h.index_offset + index.size() * sizeof(SnapshotIndexEntry),
+                              SNAPSHOT_ALIGN);
+    return snapshot_pwrite(w.fd, &h, sizeof(h), 0) &&
+           snapshot_pwrite(w.fd, index.data(), index.size() * sizeof(SnapshotIndexEntry),
+                           h.index_offset);
+}
+
+// Append one already-encoded frame and publish it in the index.
+static bool snapshot_append(SnapshotWriter& w, SnapshotFrameHeader fh,
+                            const void* payload, uint64_t payload_bytes) {
+    if (w.fd < 0 || w.n_frames >= w.max_frames) {
+        fprintf(stderr, "snapshot: frame index full (%u frames)\n", w.max_frames);
+        return false;
+    }
+    fh.magic         = SNAPSHOT_FRAME_MAGIC;
+    fh.payload_bytes = payload_bytes;
+
+    const uint64_t off = w.end;
+    if (!snapshot_pwrite(w.fd, &fh, sizeof(fh), off) ||
+        !snapshot_pwrite(w.fd, payload, (size_t)payload_bytes, off + sizeof(fh)))
+        return false;
+
+    SnapshotIndexEntry e;
+    e.offset = off;
+    e.bytes  = sizeof(fh) + payload_bytes;
+    const uint64_t slot = sizeof(SnapshotFileHeader) + (uint64_t)w.n_frames * sizeof(e);
+    if (!snapshot_pwrite(w.fd, &e, sizeof(e), slot)) return false;
+
+    // Commit point: bump the frame count only once the frame is complete.
+    ++w.n_frames;
+    if (!snapshot_pwrite(w.fd, &w.n_frames, sizeof(w.n_frames),
+                         offsetof(SnapshotFileHeader, n_frames)))
+        return false;
+
+    w.end = snapshot_align_up(off + e.bytes, SNAPSHOT_ALIGN);
+    return true;
+}
+
+// Subsample 1-in-stride particles and append them as one frame in the
+// writer's codec.
+// x/y/z point at particle 0's field and byte_stride is the distance between
+// consecutive particles: sizeof(float) for SoA, sizeof(struct) for AoS.
+static bool snapshot_write_frame(SnapshotWriter& w, int64_t iteration, double sim_time,
+                                 const float* x, const float* y, const float* z,
+                                 size_t byte_stride, int n, int stride) {
+    const uint32_t m = (uint32_t)((n + stride - 1) / stride);
+    w.gather.resize((size_t)3 * m);
+    float* gx = w.gather.data();
+    float* gy = gx + m;
+    float* gz = gy + m;
+
+    const char* px = reinterpret_cast<const char*>(x);
+    const char* py = reinterpret_cast<const char*>(y);
+    const char* pz = reinterpret_cast<const char*>(z);
+    const size_t step = byte_stride * (size_t)stride;
+    for (uint32_t j = 0; j < m; ++j) {
+        memcpy(&gx[j], px + j * step, sizeof(float));
+        memcpy(&gy[j], py + j * step, sizeof(float));
+        memcpy(&gz[j], pz + j * step, sizeof(float));
+    }
+
+    SnapshotFrameHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    fh.codec       = w.codec;
+    fh.iteration   = iteration;
+    fh.sim_time    = sim_time;
+    fh.n_particles = m;
+    fh.stride      = (uint32_t)stride;
+    if (w.codec == SNAPSHOT_CODEC_QDELTA) {
+        qdelta_encode(w.encoder, gx, gy, gz, m, w.encoded);
+        return snapshot_append(w, fh, w.encoded.data(), (uint64_t)w.encoded.size());
+    }
+    return snapshot_append(w, fh, w.gather.data(), (uint64_t)w.gather.size() * sizeof(float));
+}
+
+static void snapshot_close(SnapshotWriter& w) {
+    if (w.fd >= 0) close(w.fd);
+    w.fd = -1;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Quantised delta codec for snapshot frames (SNAPSHOT_CODEC_QDELTA).
+//
+// Positions move by only v*dt*interval between frames, so most of the 32 bits
+// in each raw float are noise. Each axis is encoded in three stages:
+//
+//   1. Quantise to 16 bits on a grid fixed at the last key frame:
+//        q = round((x - origin) / quantum),  0 <= q <= 65535
+//   2. Predict from earlier frames on the same grid and keep the residual:
+//        KEY      r = q                              (no prediction)
+//        DELTA    r = q - q_prev                     (second frame after a key)
+//        PREDICT  r = q - (2*q_prev - q_prev2)       (constant-velocity guess)
+//      Residuals are zigzag-mapped to unsigned so small magnitudes stay small.
+//   3. Bit-pack blocks of QDELTA_BLOCK residuals at the narrowest width that
+//      holds the block's largest value. For a pure drift step the PREDICT
+//      residual is quantisation rounding only, so most blocks pack to 1-2 bits.
+//
+// Every stage is a fixed-width loop over contiguous arrays with no
+// data-dependent branches apart from the range check, so compilers vectorise
+// quantise/predict/zigzag/width-reduce; only the final bit shuffle is scalar.
+//
+// Payload layout (all little-endian):
+//   QDeltaFrameHeader                       (64 bytes)
+//   per axis x, y, z  (axis_bytes[a] bytes each):
+//     uint8  width[n_blocks]                padded to a multiple of 8 bytes
+//     per block: 16 * width bytes           value j at bits [j*w, (j+1)*w), LSB first
+// The last block is zero-padded to QDELTA_BLOCK values.
+//
+// Decoding frame k needs the frames back to the previous key frame; the
+// encoder forces a key frame every key_interval frames (and whenever a
+// particle leaves the quantisation box) to bound that walk.
+// ----------------------------------------------------------------------------
+
+static const uint32_t QDELTA_KEY     = 0;
+static const uint32_t QDELTA_DELTA   = 1;
+static const uint32_t QDELTA_PREDICT = 2;
+static const uint32_t QDELTA_BLOCK   = 128;   // values per bit-packed block
+
+struct QDeltaFrameHeader {
+    uint32_t kind;            // QDELTA_KEY / QDELTA_DELTA / QDELTA_PREDICT
+    uint32_t block;           // QDELTA_BLOCK
+    float    origin[3];       // quantisation box lower corner
+    float    quantum[3];      // x = origin + q * quantum
+    uint64_t axis_bytes[3];
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(QDeltaFrameHeader) == 64, "qdelta frame header must be 64 bytes");
+
+struct QDeltaEncoder {
+    uint32_t key_interval = 16;   // frames between forced key frames
+    uint32_t since_key    = 0;    // frames encoded since the last key frame
+    uint32_t n            = 0;    // particles per frame (a change forces a key frame)
+    uint32_t history      = 0;    // usable previous frames: 0, 1 or 2+
+    float    origin[3];
+    float    quantum[3];
+    std::vector<int32_t>  q, q_prev, q_prev2;   // [3 * n], axis-major
+    std::vector<uint32_t> resid;                // [n rounded up to QDELTA_BLOCK]
+};
+
+// Quantise one axis; returns false if any value falls outside the 16-bit box.
+static bool qdelta_quantise(int32_t* q, const float* x, uint32_t n, float origin, float quantum) {
+    const float inv = 1.0f / quantum;
+    int32_t lo = 0, hi = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        int32_t v = (int32_t)floorf((x[i] - origin) * inv + 0.5f);
+        q[i] = v;
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+    }
+    return lo >= 0 && hi <= 65535;
+}
+
+// Choose a fresh quantisation box around the current positions. The box is
+// padded by half its extent on each side so drifting particles stay inside
+// it for several frames before a new key frame is needed.
+static void qdelta_choose_box(QDeltaEncoder& e, const float* const xyz[3], uint32_t n) {
+    for (int a = 0; a < 3; ++a) {
+        float lo = xyz[a][0], hi = xyz[a][0];
+        for (uint32_t i = 1; i < n; ++i) {
+            lo = xyz[a][i] < lo ? xyz[a][i] : lo;
+            hi = xyz[a][i] > hi ? xyz[a][i] : hi;
+        }
+        float pad = 0.5f * (hi - lo) + 1e-3f;
+        e.origin[a]  = lo - pad;
+        e.quantum[a] = (hi - lo + 2.0f * pad) / 65535.0f;
+    }
+}
+
+static uint32_t qdelta_width(uint32_t v) {
+    uint32_t w = 0;
+    while (v) { ++w; v >>= 1; }
+    return w;
+}
+
+// Append one axis stream (width table + packed blocks) to out.
+static uint64_t qdelta_pack_axis(std::vector<uint8_t>& out, const uint32_t* r, uint32_t n) {
+    const uint32_t n_blocks = (n + QDELTA_BLOCK - 1) / QDELTA_BLOCK;
+    const size_t   base     = out.size();
+    const size_t   table    = (n_blocks + 7) / 8 * 8;
+
+    out.resize(base + table, 0);
+    size_t total = 0;
+    for (uint32_t b = 0; b < n_blocks; ++b) {
+        uint32_t acc = 0;
+        for (uint32_t j = 0; j < QDELTA_BLOCK; ++j) acc |= r[b * QDELTA_BLOCK + j];
+        uint32_t w = qdelta_width(acc);
+        out[base + b] = (uint8_t)w;
+        total += 16 * w;
+    }
+
+    size_t p = base + table;
+    out.resize(p + total);
+    for (uint32_t b = 0; b < n_blocks; ++b) {
+        const uint32_t  w = out[base + b];
+        const uint32_t* v = r + (size_t)b * QDELTA_BLOCK;
+        uint64_t acc   = 0;
+        uint32_t nbits = 0;
+        for (uint32_t j = 0; j < QDELTA_BLOCK; ++j) {
+            acc |= (uint64_t)v[j] << nbits;
+            nbits += w;
+            while (nbits >= 8) { out[p++] = (uint8_t)acc; acc >>= 8; nbits -= 8; }
+        }
+    }
+    return (uint64_t)(out.size() - base);
+}
+
+// Encode one frame of n positions into out (QDeltaFrameHeader + axis streams).
+static void qdelta_encode(QDeltaEncoder& e, const float* x, const float* y, const float* z,
+                          uint32_t n, std::vector<uint8_t>& out) {
+    const float* const xyz[3] = { x, y, z };
+    if (e.n != n) {
+        e.n = n;
+        e.history = 0;
+        e.q.resize((size_t)3 * n);
+        e.q_prev.resize((size_t)3 * n);
+        e.q_prev2.resize((size_t)3 * n);
+    }
+    const uint32_t padded = (n + QDELTA_BLOCK - 1) / QDELTA_BLOCK * QDELTA_BLOCK;
+    e.resid.assign(padded, 0);
+
+    bool key = e.history == 0 || e.since_key >= e.key_interval;
+    if (!key) {
+        for (int a = 0; a < 3 && !key; ++a)
+            key = !qdelta_quantise(&e.q[(size_t)a * n], xyz[a], n, e.origin[a], e.quantum[a]);
+    }
+    if (key) {
+        qdelta_choose_box(e, xyz, n);
+        for (int a = 0; a < 3; ++a)
+            qdelta_quantise(&e.q[(size_t)a * n], xyz[a], n, e.origin[a], e.quantum[a]);
+        e.history   = 0;
+        e.since_key = 0;
+    }
+
+    QDeltaFrameHeader h;
+    memset(&h, 0, sizeof(h));
+    h.kind  = key ? QDELTA_KEY : (e.history == 1 ? QDELTA_DELTA : QDELTA_PREDICT);
+    h.block = QDELTA_BLOCK;
+    for (int a = 0; a < 3; ++a) { h.origin[a] = e.origin[a]; h.quantum[a] = e.quantum[a]; }
+
+    out.resize(sizeof(h));
+    for (int a = 0; a < 3; ++a) {
+        const int32_t* q  = &e.q[(size_t)a * n];
+        const int32_t* p1 = &e.q_prev[(size_t)a * n];
+        const int32_t* p2 = &e.q_prev2[(size_t)a * n];
+        uint32_t* r = e.resid.data();
+        if (h.kind == QDELTA_KEY) {
+            for (uint32_t i = 0; i < n; ++i) r[i] = (uint32_t)q[i];
+        } else if (h.kind == QDELTA_DELTA) {
+            for (uint32_t i = 0; i < n; ++i) {
+                int32_t d = q[i] - p1[i];
+                r[i] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            }
+        } else {
+            for (uint32_t i = 0; i < n; ++i) {
+                int32_t d = q[i] - (2 * p1[i] - p2[i]);
+                r[i] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            }
+        }
+        h.axis_bytes[a] = qdelta_pack_axis(out, r, n);
+    }
+    memcpy(out.data(), &h, sizeof(h));
+
+    e.q_prev2.swap(e.q_prev);
+    e.q_prev.swap(e.q);
+    ++e.history;
+    ++e.since_key;
+}
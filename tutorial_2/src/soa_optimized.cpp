@@ -1,22 +1,20 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cmath>
 #include <vector>
 
-// Structure-of-Arrays layout.
-// The hot position-update loop only touches the x, y, z, vx, vy, vz arrays.
-// Working set for those 6 arrays = 6 * 4 MB = 24 MB — fits in L3 on Graviton3.
-// Every byte loaded from those arrays is useful data: 100% cache line utilisation.
-struct ParticlesSoA {
-    std::vector<float> x, y, z;
-    std::vector<float> vx, vy, vz;
-    // Remaining fields exist but live in separate allocations and are never
-    // touched by update_positions, so they do not pollute the hot cache lines.
-    std::vector<float> mass, charge, temperature;
-    std::vector<float> pressure, energy, density;
-    std::vector<float> spin_x, spin_y, spin_z;
-};
+#include "checkpoint.h"
+#include "particles_soa.h"
+#include "snapshot.h"
 
+// Structure-of-Arrays layout.
+// ParticlesSoA (particles_soa.h) keeps one array per field, so the hot
+// position-update loop streams only x, y, z, vx, vy and vz: every byte loaded
+// from those arrays is useful data.
+//
+// The loop sits on the same lines as in aos_baseline.cpp, so the two ATP
+// source views line up.
 static void update_positions(ParticlesSoA& p, int n, float dt) {
     for (int i = 0; i < n; ++i) {
         p.x[i] += p.vx[i] * dt;
@@ -25,123 +23,110 @@ static void update_positions(ParticlesSoA& p, int n, float dt) {
     }
 }
 
-// ----------------------------------------------------------------------------
-// Minimal LCG for reproducible, dependency-free galaxy initialisation.
-// Not used in the hot loop — only called once during setup.
-// ----------------------------------------------------------------------------
-static unsigned int lcg_state = 0x12345678u;
-
-static float lcg_float() {
-    lcg_state = lcg_state * 1664525u + 1013904223u;
-    return (float)(lcg_state >> 8) * (1.0f / 16777216.0f);
-}
-
-static float lcg_gauss() {
-    float u = lcg_float() + 1e-7f;
-    float v = lcg_float();
-    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * 3.14159265f * v);
-}
-
-// Initialise particles as a two-arm logarithmic spiral galaxy.
-// Identical initial conditions to aos_baseline — only the data layout differs.
-static void init_galaxy(ParticlesSoA& p, int n) {
-    const float PI      = 3.14159265f;
-    const float v0      = 2.0f;
-    const float winding = 3.5f;
-    const float r_min   = 0.5f;
-    const float r_scale = 2.2f;
-    const float r_max   = 9.0f;
-    const float scatter = 0.30f;
-    const float z_scale = 0.15f;
-
-    for (int i = 0; i < n; ++i) {
-        float arm_offset = (i % 4) * (PI / 2.0f);
-
-        float r = r_min - r_scale * logf(lcg_float() + 1e-7f);
-        if (r > r_max) r = r_min + (r_max - r_min) * lcg_float();
-
-        float theta = arm_offset + winding * logf(r / r_min) + lcg_gauss() * scatter;
-
-        p.x[i]  =  r * cosf(theta);
-        p.y[i]  =  r * sinf(theta);
-        p.z[i]  =  lcg_gauss() * z_scale;
-
-        p.vx[i] = -v0 * sinf(theta);
-        p.vy[i] =  v0 * cosf(theta);
-        p.vz[i] =  0.0f;
-
-        p.mass[i]        = 1.0f;
-        p.charge[i]      = 0.5f;
-        p.temperature[i] = 300.0f;
-        p.pressure[i]    = 101325.0f;
-        p.energy[i]      = 0.0f;
-        p.density[i]     = 1.0f;
-        p.spin_x[i]      = 0.0f;
-        p.spin_y[i]      = 0.0f;
-        p.spin_z[i]      = 0.0f;
+// Every SoA array in a fixed order — the checkpoint stores one block per array.
+static std::vector<CheckpointField> checkpoint_fields(ParticlesSoA& p) {
+    std::vector<ParticlesSoA::Field> arrays = p.fields();
+    std::vector<CheckpointField> fields;
+    for (size_t k = 0; k < arrays.size(); ++k) {
+        CheckpointField f = { arrays[k].name, arrays[k].data->data(),
+                              arrays[k].data->size() * sizeof(float) };
+        fields.push_back(f);
     }
+    return fields;
 }
 
 int main(int argc, char* argv[]) {
-    const int   N              = 1 << 20; // 1,048,576 particles — same as AoS baseline
+    int         N              = 1 << 20; // 1,048,576 particles — same as AoS baseline (--particles N)
     const int   default_iters  = 200;
     const int   vis_iters      = 1000;
     const float dt    = 0.005f;
 
-    bool do_vis = false;
+    bool do_vis     = false;
+    bool compress   = false;  // --compress: quantised delta frames (snapshot_codec.h)
+    int  vis_stride = 16;     // --vis-stride S: keep 1-in-S particles per frame
+
+    // --checkpoint-every K: atomically save full state every K iterations.
+    // --resume: start from the checkpoint instead of init_galaxy.
+    const char* ckpt_path  = "galaxy_soa.ckpt";  // --checkpoint PATH
+    int         ckpt_every = 0;
+    bool        resume     = false;
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--visualize") == 0) {
             do_vis = true;
-            break;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "--vis-stride") == 0 && i + 1 < argc) {
+            vis_stride = atoi(argv[++i]);
+            if (vis_stride < 1) vis_stride = 1;
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            ckpt_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            ckpt_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            N = atoi(argv[++i]);
         }
     }
+    if (N < 1) {
+        fprintf(stderr, "--particles must be positive\n");
+        return 1;
+    }
 
     const int iters = do_vis ? vis_iters : default_iters;
 
-    const int vis_stride   = 16;
     const int vis_interval = 10;
-    const int vis_n        = N / vis_stride;
     const int vis_frames   = 1 + iters / vis_interval;
 
     ParticlesSoA particles;
-    particles.x.resize(N);           particles.y.resize(N);
-    particles.z.resize(N);           particles.vx.resize(N);
-    particles.vy.resize(N);          particles.vz.resize(N);
-    particles.mass.resize(N);        particles.charge.resize(N);
-    particles.temperature.resize(N); particles.pressure.resize(N);
-    particles.energy.resize(N);      particles.density.resize(N);
-    particles.spin_x.resize(N);      particles.spin_y.resize(N);
-    particles.spin_z.resize(N);
-
-    init_galaxy(particles, N);
-
-    FILE* vis_fp = nullptr;
-    if (do_vis) {
-        vis_fp = fopen("galaxy_soa.bin", "wb");
-        fwrite(&vis_n,      sizeof(int), 1, vis_fp);
-        fwrite(&vis_frames, sizeof(int), 1, vis_fp);
+    particles.resize(N);
+
+    std::vector<CheckpointField> ckpt = checkpoint_fields(particles);
+    uint64_t seed       = GALAXY_SEED;
+    int      start_iter = 0;
+    if (resume) {
+        int64_t  saved_iter = 0;
+        uint64_t saved_seed = 0;
+        if (!checkpoint_load(ckpt_path, CHECKPOINT_LAYOUT_SOA, N, saved_iter, saved_seed,
+                             ckpt.data(), (uint32_t)ckpt.size()))
+            return 1;
+        start_iter = (int)saved_iter;
+        seed       = saved_seed;
+        printf("Resumed from %s at iteration %d\n", ckpt_path, start_iter);
+    } else {
+        init_galaxy(particles, N, seed);
     }
 
-    // Helper: write one subsampled frame (x-array, then y-array, then z-array).
-    auto dump_frame = [&]() {
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles.x[j], sizeof(float), 1, vis_fp);
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles.y[j], sizeof(float), 1, vis_fp);
-        for (int j = 0; j < N; j += vis_stride)
-            fwrite(&particles.z[j], sizeof(float), 1, vis_fp);
+    SnapshotWriter vis;
+    if (do_vis && !snapshot_open(vis, "galaxy_soa.bin", (uint32_t)vis_frames,
+                                compress ? SNAPSHOT_CODEC_QDELTA : SNAPSHOT_CODEC_RAW))
+        return 1;
+
+    // Helper: append one subsampled frame to the seekable snapshot file.
+    auto dump_frame = [&](int iter) {
+        if (!snapshot_write_frame(vis, iter, iter * (double)dt,
+                                  particles.x.data(), particles.y.data(), particles.z.data(),
+                                  sizeof(float), N, vis_stride)) {
+            fprintf(stderr, "snapshot: write failed at iteration %d\n", iter);
+            exit(1);
+        }
     };
 
-    if (do_vis) dump_frame();
+    if (do_vis) dump_frame(start_iter);
 
-    for (int iter = 0; iter < iters; ++iter) {
+    for (int iter = start_iter; iter < iters; ++iter) {
         update_positions(particles, N, dt);
 
         if (do_vis && (iter + 1) % vis_interval == 0)
-            dump_frame();
+            dump_frame(iter + 1);
+
+        if (ckpt_every > 0 && (iter + 1) % ckpt_every == 0 &&
+            !checkpoint_save(ckpt_path, CHECKPOINT_LAYOUT_SOA, N, iter + 1, seed,
+                             ckpt.data(), (uint32_t)ckpt.size()))
+            return 1;
     }
 
-    if (vis_fp) fclose(vis_fp);
+    snapshot_close(vis);
 
     // Checksum — same formula as AoS baseline; values must match.
     double checksum = 0.0;
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "cell_list.h"
+#include "particles_soa.h"
+
+// ----------------------------------------------------------------------------
+// Smoothed particle hydrodynamics over the ParticlesSoA cold fields.
+//
+// Stages, each its own parallel pass:
+//   neighbours  cell list with radius 2h (cell_list.h)
+//   density     rho_i = sum_j m_j W(r_ij, h)                         (mass -> density)
+//   eos         P = (gamma - 1) rho u, T = u / u_per_kelvin          (density, energy -> pressure, temperature)
+//   force       a_i  = -sum_j m_j (P_i/rho_i^2 + P_j/rho_j^2) grad W  (-> accelerations)
+//               du_i =  P_i/rho_i^2 sum_j m_j (v_i - v_j) . grad W
+//   energy      u += du dt                                            (energy)
+//
+// W is the cubic-spline (M4) kernel with support 2h. `energy` holds the
+// specific internal energy u.
+//
+// Stages that sum over neighbours work in cell-slot order, so each neighbour
+// run is contiguous. Each of them gathers just the fields it reads into slot
+// order and scatters its output back. The stream-only stages (eos, energy)
+// run directly on the SoA arrays in particle order. Either way a stage
+// touches only the fields it needs.
+// The inner loops use selects rather than branches for the kernel's three
+// pieces, so they vectorise.
+//
+// SPH_BYTES_* is the compulsory memory traffic of each stage per particle:
+// every array it reads or writes, counted once. Stage time plus these numbers
+// give the effective bandwidth.
+// ----------------------------------------------------------------------------
+
+struct SPHParams {
+    float h            = 0.025f;       // smoothing length (kernel support 2h)
+    float gamma        = 5.0f / 3.0f;  // adiabatic index
+    float u_per_kelvin = 1e-4f;        // specific energy per unit temperature
+};
+
+struct SPHState {
+    CellList           cl;
+    std::vector<float> m, rho, P;       // slot order
+    std::vector<float> vx, vy, vz;      // slot order
+    std::vector<float> ax, ay, az, du;  // slot order results
+    std::vector<float> du_part;         // du/dt in particle order
+};
+
+// index, mass, slot x/y/z/m, slot rho, density.
+static const int SPH_BYTES_DENSITY = 4 + 4 + 16 + 4 + 4;
+// density, energy, pressure, temperature.
+static const int SPH_BYTES_EOS     = 16;
+// index, v, density + pressure, slot v, slot rho + P, slot x/y/z, slot m,
+// slot a + du, a, du.
+static const int SPH_BYTES_FORCE   = 4 + 12 + 8 + 12 + 8 + 12 + 4 + 16 + 12 + 4;
+// energy (read and written), du.
+static const int SPH_BYTES_ENERGY  = 12;
+
+static inline float sph_sigma(const SPHParams& prm) {
+    return 1.0f / (3.14159265f * prm.h * prm.h * prm.h);
+}
+
+// Set u from the temperature field (init_galaxy sets temperature only).
+static void sph_init_energy(ParticlesSoA& p, int n, const SPHParams& prm) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) p.energy[i] = p.temperature[i] * prm.u_per_kelvin;
+}
+
+static void sph_neighbours(SPHState& s, const ParticlesSoA& p, int n, const SPHParams& prm) {
+    cell_list_build(s.cl, p, n, 2.0f * prm.h);
+}
+
+static void sph_density(SPHState& s, ParticlesSoA& p, int n, const SPHParams& prm) {
+    const CellList& cl = s.cl;
+    s.m.resize(n);
+    s.rho.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) s.m[k] = p.mass[cl.index[k]];
+
+    const float  inv_h = 1.0f / prm.h;
+    const float  r2max = 4.0f * prm.h * prm.h;
+    const float  sigma = sph_sigma(prm);
+    const float* px = cl.px.data();
+    const float* py = cl.py.data();
+    const float* pz = cl.pz.data();
+    const float* m  = s.m.data();
+    const long   n_cells = (long)cell_list_cells(cl);
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (long c = 0; c < n_cells; ++c) {
+        const uint32_t b = cl.cell_start[c], e = cl.cell_start[c + 1];
+        if (b == e) continue;
+        uint32_t rb[9], re[9];
+        const int n_ranges = cell_list_ranges(cl, (size_t)c, rb, re);
+        for (uint32_t k = b; k < e; ++k) {
+            const float xk = px[k], yk = py[k], zk = pz[k];
+            float sum = 0.0f;
+            for (int q = 0; q < n_ranges; ++q) {
+                #pragma omp simd reduction(+: sum)
+                for (uint32_t j = rb[q]; j < re[q]; ++j) {
+                    const float dx = px[j] - xk, dy = py[j] - yk, dz = pz[j] - zk;
+                    const float r2 = dx * dx + dy * dy + dz * dz;
+                    const float u  = sqrtf(r2) * inv_h;
+                    const float t  = 2.0f - u;
+                    const float w  = u < 1.0f ? 1.0f - 1.5f * u * u + 0.75f * u * u * u
+                                              : 0.25f * t * t * t;
+                    sum += r2 < r2max ? m[j] * w : 0.0f;
+                }
+            }
+            s.rho[k] = sigma * sum;
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) p.density[cl.index[k]] = s.rho[k];
+}
+
+static void sph_equation_of_state(ParticlesSoA& p, int n, const SPHParams& prm) {
+    const float  g1   = prm.gamma - 1.0f;
+    const float  inv_ku = 1.0f / prm.u_per_kelvin;
+    const float* rho  = p.density.data();
+    const float* u    = p.energy.data();
+    float*       P    = p.pressure.data();
+    float*       T    = p.temperature.data();
+    #pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < n; ++i) {
+        P[i] = g1 * rho[i] * u[i];
+        T[i] = u[i] * inv_ku;
+    }
+}
+
+// Pressure accelerations (particle order, into ax/ay/az) and du/dt (kept in
+// s.du_part for sph_energy_update).
+static void sph_pressure_force(SPHState& s, const ParticlesSoA& p, int n, const SPHParams& prm,
+                               float* ax, float* ay, float* az) {
+    const CellList& cl = s.cl;
+    s.vx.resize(n); s.vy.resize(n); s.vz.resize(n);
+    s.rho.resize(n); s.P.resize(n);
+    s.ax.resize(n); s.ay.resize(n); s.az.resize(n); s.du.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = cl.index[k];
+        s.vx[k]  = p.vx[i];      s.vy[k] = p.vy[i]; s.vz[k] = p.vz[i];
+        s.rho[k] = p.density[i]; s.P[k]  = p.pressure[i];
+    }
+
+    const float  inv_h = 1.0f / prm.h;
+    const float  r2max = 4.0f * prm.h * prm.h;
+    const float  gscale = sph_sigma(prm) * inv_h;   // dW/dr = gscale * f(u)
+    const float* px = cl.px.data();
+    const float* py = cl.py.data();
+    const float* pz = cl.pz.data();
+    const float* vx = s.vx.data();
+    const float* vy = s.vy.data();
+    const float* vz = s.vz.data();
+    const float* m  = s.m.data();
+    const float* rho = s.rho.data();
+    const float* P   = s.P.data();
+    const long   n_cells = (long)cell_list_cells(cl);
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (long c = 0; c < n_cells; ++c) {
+        const uint32_t b = cl.cell_start[c], e = cl.cell_start[c + 1];
+        if (b == e) continue;
+        uint32_t rb[9], re[9];
+        const int n_ranges = cell_list_ranges(cl, (size_t)c, rb, re);
+        for (uint32_t k = b; k < e; ++k) {
+            const float xk = px[k], yk = py[k], zk = pz[k];
+            const float vxk = vx[k], vyk = vy[k], vzk = vz[k];
+            const float pk = P[k] / (rho[k] * rho[k]);
+            float sx = 0.0f, sy = 0.0f, sz = 0.0f, sd = 0.0f;
+            for (int q = 0; q < n_ranges; ++q) {
+                #pragma omp simd reduction(+: sx, sy, sz, sd)
+                for (uint32_t j = rb[q]; j < re[q]; ++j) {
+                    const float dx = px[j] - xk, dy = py[j] - yk, dz = pz[j] - zk;
+                    const float r2 = dx * dx + dy * dy + dz * dz;
+                    const float inv_r = r2 > 0.0f ? 1.0f / sqrtf(r2) : 0.0f;
+                    const float u  = r2 * inv_r * inv_h;
+                    const float t  = 2.0f - u;
+                    const float dw = u < 1.0f ? -3.0f * u + 2.25f * u * u : -0.75f * t * t;
+                    // dW/dr / r, zero outside the support and for j == k.
+                    const float g  = r2 < r2max ? dw * inv_r : 0.0f;
+                    const float mg = m[j] * g;
+                    const float f  = mg * (pk + P[j] / (rho[j] * rho[j]));
+                    sx += f * dx; sy += f * dy; sz += f * dz;
+                    sd += mg * ((vx[j] - vxk) * dx + (vy[j] - vyk) * dy + (vz[j] - vzk) * dz);
+                }
+            }
+            s.ax[k] = gscale * sx;
+            s.ay[k] = gscale * sy;
+            s.az[k] = gscale * sz;
+            s.du[k] = gscale * pk * sd;
+        }
+    }
+
+    s.du_part.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; ++k) {
+        const uint32_t i = cl.index[k];
+        ax[i] = s.ax[k]; ay[i] = s.ay[k]; az[i] = s.az[k];
+        s.du_part[i] = s.du[k];
+    }
+}
+
+static void sph_energy_update(SPHState& s, ParticlesSoA& p, int n, float dt) {
+    float*       u  = p.energy.data();
+    const float* du = s.du_part.data();
+    #pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < n; ++i) {
+        const float v = u[i] + du[i] * dt;
+        u[i] = v > 0.0f ? v : 0.0f;
+    }
+}
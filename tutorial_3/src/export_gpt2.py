@@ -13,10 +13,16 @@ from transformers import GPT2Model, GPT2Tokenizer
 REPO_ROOT = Path(__file__).resolve().parent.parent
 DEFAULT_MODELS_DIR = REPO_ROOT / "models"
 
+# Version 2 pads before each tensor's data so it starts on a WEIGHTS_ALIGN
+# boundary; gpt2.cpp mmaps the file and uses the tensors in place.
+WEIGHTS_VERSION = 2
+WEIGHTS_ALIGN   = 64
+
 def write_tensor(f, arr, name=""):
     arr = arr.astype("float32")
     f.write(struct.pack('<I', arr.ndim))
     for d in arr.shape: f.write(struct.pack('<I', int(d)))
+    f.write(b'\0' * (-f.tell() % WEIGHTS_ALIGN))
     f.write(arr.tobytes())
     print(f"  {name}  {arr.shape}")
 
@@ -24,7 +30,7 @@ def export_weights(model_name, out_path):
     model = GPT2Model.from_pretrained(model_name).eval()
     c = model.config
     with open(out_path, 'wb') as f:
-        f.write(struct.pack('<II', 0x67707432, 1))           # magic, version
+        f.write(struct.pack('<II', 0x67707432, WEIGHTS_VERSION))  # magic, version
         f.write(struct.pack('<IIIII',
             c.vocab_size, c.n_ctx, c.n_embd, c.n_layer, c.n_head))
 
@@ -13,6 +13,17 @@
  *   -n  max new tokens (default 200)
  *   -t  temperature    (default 1.0,  0 = greedy)
  *   -p  top-p          (default 0.9)
+ *   --prefill-block N  prompt tokens per batched prefill pass (default 128, 1 = token by token)
+ *   --threads N        OpenMP threads (default: all cores)
+ *   --scaling          report greedy decode tok/s from 1 thread up to --threads
+ *   --serve FILE|-     serve the prompts in FILE (one per line, - = stdin) with continuous batching
+ *   --batch B          concurrent requests when serving (default 8)
+ *   --rate R           request arrivals per second, Poisson (default 0 = all at once)
+ *   --requests N       requests to send, cycling through the prompts (default: one per prompt)
+ *   --kv-pages N       KV cache pool size in pages of 16 positions (default: every slot can reach n_ctx)
+ *   --no-prefix-cache  don't share KV pages between requests with a common prompt prefix
+ *   --kv-type T        KV cache element type: f32 (default), f16 or q8
+ *   --perplexity FILE  perplexity of FILE with a float32 and a --kv-type KV cache
  */
 
  #include <algorithm>
@@ -20,15 +31,29 @@
  #include <climits>
  #include <cmath>
  #include <cstdint>
+ #include <cstdio>
  #include <cstdlib>
+ #include <cstring>
  #include <fstream>
  #include <iostream>
+ #include <memory>
  #include <numeric>
  #include <random>
  #include <string>
+ #include <thread>
+ #include <type_traits>
  #include <unordered_map>
  #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #ifndef GPT2_DEFAULT_MODELS_DIR
 #define GPT2_DEFAULT_MODELS_DIR "models"
 #endif
@@ -51,38 +76,235 @@
      int vocab_size, n_ctx, n_embd, n_layer, n_head;
  };
  
- // ── weights (all float32, flat vectors) ──────────────────────────────────────
+ static const int PREFILL_BLOCK = 128;   // prompt tokens per forward_batch call
+ static const int KV_PAGE       = 16;    // positions per KV cache page
+ 
+ // Element type of the KV cache: float32, FP16, or INT8 with a float scale per
+ // head of every position.
+ enum KVType { KV_F32, KV_F16, KV_Q8 };
+ static const char *const KV_TYPE_NAMES[] = { "f32", "f16", "q8" };
+ 
+ // ── weights (float32, used in place from the mmap'ed weights file) ──────────
+ 
+ // Read-only view of one tensor inside the mapping. data()/size() match
+ // std::vector, so the forward pass does not care where the floats live.
+ struct Tensor {
+     const float *ptr = nullptr;
+     size_t n = 0;
+     const float *data() const { return ptr; }
+     size_t size() const { return n; }
+ };
  
  struct Weights {
-     std::vector<float> wte, wpe;                       // embeddings
-     std::vector<float> ln1_w, ln1_b;                   // (n_layer, n_embd)
-     std::vector<float> c_attn_w, c_attn_b;             // (n_layer, 3E, E) / (n_layer, 3E)
-     std::vector<float> c_proj_w, c_proj_b;             // (n_layer, E, E)  / (n_layer, E)
-     std::vector<float> ln2_w, ln2_b;
-     std::vector<float> mlp_fc_w, mlp_fc_b;             // (n_layer, 4E, E)
-     std::vector<float> mlp_pj_w, mlp_pj_b;             // (n_layer, E, 4E)
-     std::vector<float> ln_f_w, ln_f_b;
+     Tensor wte, wpe;                                   // embeddings
+     Tensor ln1_w, ln1_b;                               // (n_layer, n_embd)
+     Tensor c_attn_w, c_attn_b;                         // (n_layer, 3E, E) / (n_layer, 3E)
+     Tensor c_proj_w, c_proj_b;                         // (n_layer, E, E)  / (n_layer, E)
+     Tensor ln2_w, ln2_b;
+     Tensor mlp_fc_w, mlp_fc_b;                         // (n_layer, 4E, E)
+     Tensor mlp_pj_w, mlp_pj_b;                         // (n_layer, E, 4E)
+     Tensor ln_f_w, ln_f_b;
+ 
+     void  *map = nullptr;                              // the whole weights file
+     size_t map_size = 0;
+ 
+     Weights() = default;
+     Weights(const Weights &) = delete;
+     Weights &operator=(const Weights &) = delete;
+     ~Weights() { if (map) munmap(map, map_size); }
  };
 
  
+ // ── KV cache ──────────────────────────────────────────────────────────────────
+
+ // Keys and values live in pages of KV_PAGE positions drawn from one pool
+ // shared by all sequences; a page holds (n_layer, KV_PAGE, E) floats of K
+ // and the same of V. Each sequence has a page table mapping position / KV_PAGE
+ // to a page. Pages are allocated the first time a position in them is
+ // written and go back to the pool when no sequence holds them, so memory
+ // follows the tokens in flight rather than n_seq * n_ctx. The pool never
+ // grows beyond max_pages.
+ //
+ // Full pages of a prompt can be published to a prefix cache keyed by a hash
+ // of all the tokens up to the end of the page. A later sequence with the same
+ // prefix attaches those pages instead of recomputing them. Shared and cached
+ // pages are copy-on-write: make_writable gives a sequence its own copy before
+ // it writes into one. A cached page that no sequence holds stays in the pool
+ // until it is needed for a new page, least recently released first.
+ //
+ // A page of K (or V) holds (n_layer, KV_PAGE, E) elements of type, followed
+ // for KV_Q8 by (n_layer, KV_PAGE, H) scales. store() converts on the way in
+ // and attend_head dequantises on the way out.
+ struct KVCache {
+     KVType type = KV_F32;
+     int n_layer = 0, E = 0, H = 0, max_pages = 0;
+     size_t elem = sizeof(float);                   // bytes per stored element
+     std::vector<std::unique_ptr<uint8_t[]>> k, v;  // page id -> page
+     std::vector<int> refs;                         // page id -> page tables holding it
+     std::vector<uint64_t> page_key;                // page id -> prefix key, 0 if not cached
+     std::vector<uint64_t> released;                // page id -> when it was last released
+     std::vector<int> free_pages;
+     std::vector<std::vector<int>> table;           // sequence -> page ids in position order
+     std::unordered_map<uint64_t, int> prefix;      // prefix key -> page id
+     uint64_t clock = 0;
+ 
+     void init(const Config &c, int n_seq, int pages, KVType t) {
+         type = t; n_layer = c.n_layer; E = c.n_embd; H = c.n_head; max_pages = pages;
+         elem = t == KV_F32 ? sizeof(float) : t == KV_F16 ? sizeof(_Float16) : sizeof(int8_t);
+         k.clear(); v.clear(); refs.clear(); page_key.clear(); released.clear();
+         free_pages.clear(); prefix.clear();
+         table.assign(n_seq, {});
+     }
+     size_t data_bytes() const { return (size_t)n_layer * KV_PAGE * E * elem; }
+     // Bytes of one page of K (or V), scales included.
+     size_t half_bytes() const {
+         return data_bytes() + (type == KV_Q8 ? (size_t)n_layer * KV_PAGE * H * sizeof(float) : 0);
+     }
+     // Bytes of K and V in one page.
+     size_t page_bytes() const { return 2 * half_bytes(); }
+     // Pages allocated so far (in use, cached or free).
+     int allocated() const { return (int)k.size(); }
+ 
+     // A free page, a new one while the pool is below max_pages, or else the
+     // cached page that was released longest ago, dropped from the cache.
+     int alloc_page() {
+         int pg = -1;
+         if (!free_pages.empty()) {
+             pg = free_pages.back(); free_pages.pop_back();
+         } else if ((int)k.size() < max_pages) {
+             pg = (int)k.size();
+             k.emplace_back(new uint8_t[half_bytes()]);
+             v.emplace_back(new uint8_t[half_bytes()]);
+             refs.push_back(0); page_key.push_back(0); released.push_back(0);
+         } else {
+             for (int i = 0; i < (int)k.size(); i++)
+                 if (refs[i] == 0 && page_key[i] && (pg < 0 || released[i] < released[pg])) pg = i;
+             if (pg < 0) {
+                 std::cerr << "KV cache is out of pages (" << max_pages << ")\n"; std::exit(1);
+             }
+             prefix.erase(page_key[pg]);
+             page_key[pg] = 0;
+         }
+         refs[pg] = 1;
+         return pg;
+     }
+     void unref(int pg) {
+         if (--refs[pg] > 0) return;
+         if (page_key[pg]) released[pg] = ++clock;  // stays cached until evicted
+         else free_pages.push_back(pg);
+     }
+ 
+     // Gives seq pages for positions 0 .. n-1.
+     void reserve(int seq, int n) {
+         std::vector<int> &t = table[seq];
+         while ((int)t.size() * KV_PAGE < n) t.push_back(alloc_page());
+     }
+     // Copies the page holding pos first if seq shares it or it is cached.
+     void make_writable(int seq, int pos) {
+         int &pg = table[seq][pos / KV_PAGE];
+         if (refs[pg] == 1 && !page_key[pg]) return;
+         int copy = alloc_page();
+         std::memcpy(k[copy].get(), k[pg].get(), half_bytes());
+         std::memcpy(v[copy].get(), v[pg].get(), half_bytes());
+         unref(pg);
+         pg = copy;
+     }
+     // Returns seq's pages to the pool.
+     void release(int seq) {
+         for (int pg : table[seq]) unref(pg);
+         table[seq].clear();
+     }
+ 
+     // Prefix key of the page after the one keyed parent: FNV-1a over its
+     // KV_PAGE tokens, chained so the key covers the whole prefix.
+     static uint64_t page_hash(uint64_t parent, const int *tokens) {
+         const uint8_t *p = (const uint8_t *)tokens;
+         for (size_t i = 0; i < KV_PAGE * sizeof(int); i++) parent = (parent ^ p[i]) * 1099511628211ull;
+         return parent ? parent : 1;
+     }
+     // Attaches the cached pages matching the longest page-aligned prefix of
+     // tokens[0 .. n) to seq, whose table must be empty. Returns the number of
+     // positions attached.
+     int attach_prefix(int seq, const int *tokens, int n) {
+         uint64_t h = 14695981039346656037ull;
+         for (int p = 0; (p + 1) * KV_PAGE <= n; p++) {
+             h = page_hash(h, tokens + p * KV_PAGE);
+             auto it = prefix.find(h);
+             if (it == prefix.end()) break;
+             refs[it->second]++;
+             table[seq].push_back(it->second);
+         }
+         return (int)table[seq].size() * KV_PAGE;
+     }
+     // Publishes seq's pages that hold only tokens[0 .. n) to the prefix cache.
+     void publish_prefix(int seq, const int *tokens, int n) {
+         uint64_t h = 14695981039346656037ull;
+         for (int p = 0; (p + 1) * KV_PAGE <= n; p++) {
+             h = page_hash(h, tokens + p * KV_PAGE);
+             int pg = table[seq][p];
+             if (!page_key[pg] && prefix.emplace(h, pg).second) page_key[pg] = h;
+         }
+     }
+ 
+     // Writes the key and value of (seq, layer, pos), E floats each.
+     void store(int seq, int l, int pos, const float *K, const float *V) {
+         const int pg = table[seq][pos / KV_PAGE];
+         const size_t row = (size_t)l * KV_PAGE + pos % KV_PAGE;
+         put(k[pg].get(), row, K);
+         put(v[pg].get(), row, V);
+     }
+     void put(uint8_t *page, size_t row, const float *x) const {
+         if (type == KV_F32) {
+             std::memcpy((float *)page + row * E, x, E * sizeof(float));
+         } else if (type == KV_F16) {
+             _Float16 *d = (_Float16 *)page + row * E;
+             for (int i = 0; i < E; i++) d[i] = (_Float16)x[i];
+         } else {
+             // Symmetric INT8 per head: scale = max |x| / 127.
+             const int hs = E / H;
+             int8_t *d = (int8_t *)page + row * E;
+             float *scales = (float *)(page + data_bytes()) + row * H;
+             for (int h = 0; h < H; h++) {
+                 const float *xh = x + h * hs;
+                 float m = 0;
+                 for (int i = 0; i < hs; i++) m = std::max(m, std::fabs(xh[i]));
+                 scales[h] = m / 127.f;
+                 const float inv = m > 0 ? 127.f / m : 0.f;
+                 for (int i = 0; i < hs; i++) d[h * hs + i] = (int8_t)std::lrint(xh[i] * inv);
+             }
+         }
+     }
+ };
+ 
  // ── run-time state ────────────────────────────────────────────────────────────
 
  struct State {
      std::vector<float> x, xb, qkv, attn_out, mlp_h, logits, proj_buf;
-     std::vector<float> key_cache, val_cache;   // (n_layer, n_ctx, n_embd)
+     KVCache kv;
      std::vector<float> att_score;              // (n_head, n_ctx)
+     int max_rows = 0;                          // forward_batch buffers: max_rows rows each
+     std::vector<float> bx, bxb, bqkv, battn, bmlp, bproj;
+     std::vector<float> blogits;                // (n_seq, vocab_size): one logits row per sequence
 
-     void init(const Config &c) {
+     // kv_pages = 0 sizes the pool for n_seq sequences of n_ctx tokens.
+     void init(const Config &c, int n_seq = 1, int rows = PREFILL_BLOCK, int kv_pages = 0,
+               KVType kv_type = KV_F32) {
          int E = c.n_embd;
          x.assign(E, 0); xb.assign(E, 0);
          qkv.assign(3*E, 0); attn_out.assign(E, 0);
          mlp_h.assign(4*E, 0);
          proj_buf.assign(4*E, 0);   // reusable projection scratch buffer (max dim = 4E)
          logits.assign(c.vocab_size, 0);
-         key_cache.assign((size_t)c.n_layer * c.n_ctx * E, 0);
-         val_cache.assign((size_t)c.n_layer * c.n_ctx * E, 0);
+         if (kv_pages <= 0) kv_pages = n_seq * ((c.n_ctx + KV_PAGE - 1) / KV_PAGE);
+         kv.init(c, n_seq, kv_pages, kv_type);
          att_score.assign((size_t)c.n_head  * c.n_ctx,    0);
-     }
+         max_rows = rows;
+         const size_t B = rows;
+         bx.assign(B*E, 0);     bxb.assign(B*E, 0);
+         bqkv.assign(B*3*E, 0); battn.assign(B*E, 0);
+         bmlp.assign(B*4*E, 0); bproj.assign(B*E, 0);
+         blogits.assign((size_t)n_seq*c.vocab_size, 0);
+      }
  };
  
  // ── math primitives ──────────────────────────────────────────────────────────
@@ -95,10 +317,72 @@
      float inv = 1.f / sqrtf((float)(var/n + 1e-5));
      for (int i = 0; i < n; i++) o[i] = w[i] * ((x[i]-(float)mean)*inv) + b[i];
  }
+  
+ // One head of causal attention for the query at position pos of sequence
+ // seq: scores against the cached keys 0..pos, softmax, then the
+ // softmax-weighted sum of the cached values into oh (zeroed by the caller).
+ // The cache is walked page by page through the sequence's page table, and
+ // T is the element type the cache stores. Elements are widened to float as
+ // they are loaded. An INT8 head's scale is applied once per position, to its
+ // score and to its softmax weight, not to every element.
+ template <typename T>
+ static void attend_head_kv(float *oh, const float *q, const KVCache &kv, int seq, int l, int h,
+                            float *sc, int pos, int hs, float scale) {
+     const bool q8 = std::is_same<T, int8_t>::value;
+     const std::vector<int> &pages = kv.table[seq];
+     const int E = kv.E, H = kv.H;
+     const size_t loff = (size_t)l * KV_PAGE * E + (size_t)h * hs;   // this layer and head within a page
+     const size_t soff = (size_t)l * KV_PAGE * H + h;                 // and its INT8 scales
+     // ── Step 1: Compute attention scores (Q·K^T / sqrt(hs)) ──
+     for (int p0 = 0; p0 <= pos; p0 += KV_PAGE) {
+         const uint8_t *page = kv.k[pages[p0 / KV_PAGE]].get();
+         const T *kp = (const T *)page + loff;
+         const float *ks = q8 ? (const float *)(page + kv.data_bytes()) + soff : nullptr;
+         const int n = std::min(KV_PAGE, pos + 1 - p0);
+         for (int j = 0; j < n; j++) {
+             float dot = 0;
+             const T *k_t = kp + (size_t)j*E;          // key at position p0+j, this head's slice
+             #pragma omp simd reduction(+: dot)
+             for (int i = 0; i < hs; i++) dot += q[i]*(float)k_t[i];
+             if (q8) dot *= ks[(size_t)j*H];
+             sc[p0+j] = dot * scale;                   // scaled dot product → raw attention score
+         }
+     }
+ 
+     // ── Step 2: Softmax over all positions ──
+     float mx = *std::max_element(sc, sc+pos+1), sm = 0;
+     for (int t = 0; t<=pos; t++) { sc[t]=expf(sc[t]-mx); sm+=sc[t]; }  // subtract max for stability
+     for (int t = 0; t<=pos; t++) sc[t] /= sm;                           // normalize to sum to 1
+ 
+     // ── Step 3: Weighted sum of values → attention output for this head ──
+     for (int p0 = 0; p0 <= pos; p0 += KV_PAGE) {
+         const uint8_t *page = kv.v[pages[p0 / KV_PAGE]].get();
+         const T *vp = (const T *)page + loff;
+         const float *vs = q8 ? (const float *)(page + kv.data_bytes()) + soff : nullptr;
+         const int n = std::min(KV_PAGE, pos + 1 - p0);
+         for (int j = 0; j < n; j++) {
+             const T *v_t = vp + (size_t)j*E;          // value at position p0+j, this head's slice
+             float a = sc[p0+j];                       // softmax weight for position p0+j
+             if (q8) a *= vs[(size_t)j*H];
+             #pragma omp simd
+             for (int i = 0; i < hs; i++) oh[i] += a*(float)v_t[i];  // accumulate: output += a * V_t
+         }
+     }
+ }
+ 
+ static void attend_head(float *oh, const float *q, const KVCache &kv, int seq, int l, int h,
+                         float *sc, int pos, int hs, float scale) {
+     switch (kv.type) {
+     case KV_F32: attend_head_kv<float>   (oh, q, kv, seq, l, h, sc, pos, hs, scale); break;
+     case KV_F16: attend_head_kv<_Float16>(oh, q, kv, seq, l, h, sc, pos, hs, scale); break;
+     case KV_Q8:  attend_head_kv<int8_t>  (oh, q, kv, seq, l, h, sc, pos, hs, scale); break;
+     }
+ }
  
  // W is (n_out x n_in) row-major
  static void matmul(float *out, const float *x, const float *W, const float *b,
                     int n_in, int n_out) {
+     #pragma omp parallel for schedule(static)
      for (int i = 0; i < n_out; i++) {
          float acc = b ? b[i] : 0.f;
          const float *row = W + (size_t)i * n_in;
@@ -106,6 +390,41 @@
          out[i] = acc;
      }
  }
+  
+ // matmul for T input rows: x is (T x n_in), out is (T x n_out). Each weight
+ // row is applied to all T rows while it is in cache, so a block of tokens
+ // streams W from memory once instead of once per token. Rows go four at a
+ // time: one load of row[j] feeds four independent accumulators instead of a
+ // single dependent chain. Every output is still summed in the same order as
+ // in matmul, so the results are bit-identical.
+ static void matmul_batch(float *out, const float *x, const float *W, const float *b,
+                          int T, int n_in, int n_out) {
+     #pragma omp parallel for schedule(static)
+     for (int i = 0; i < n_out; i++) {
+         const float *row = W + (size_t)i * n_in;
+         const float bi = b ? b[i] : 0.f;
+         int t = 0;
+         for (; t + 4 <= T; t += 4) {
+             const float *x0 = x + (size_t)t * n_in, *x1 = x0 + n_in;
+             const float *x2 = x1 + n_in, *x3 = x2 + n_in;
+             float a0 = bi, a1 = bi, a2 = bi, a3 = bi;
+             for (int j = 0; j < n_in; j++) {
+                 const float r = row[j];
+                 a0 += r * x0[j]; a1 += r * x1[j]; a2 += r * x2[j]; a3 += r * x3[j];
+             }
+             out[(size_t)t * n_out + i]       = a0;
+             out[(size_t)(t+1) * n_out + i]   = a1;
+             out[(size_t)(t+2) * n_out + i]   = a2;
+             out[(size_t)(t+3) * n_out + i]   = a3;
+         }
+         for (; t < T; t++) {
+             const float *xt = x + (size_t)t * n_in;
+             float acc = bi;
+             for (int j = 0; j < n_in; j++) acc += row[j] * xt[j];
+             out[(size_t)t * n_out + i] = acc;
+         }
+     }
+ }
  
  // ── forward pass ─────────────────────────────────────────────────────────────
  
@@ -120,6 +439,8 @@
      for (int i = 0; i < E; i++) s.x[i] = te[i] + pe[i];
  
      // 2. Layers
+     s.kv.reserve(0, pos+1);
+     s.kv.make_writable(0, pos);
      for (int l = 0; l < cfg.n_layer; l++) {
          // ── Attention ─────────────────────────────────────────────────────
          layernorm(s.xb.data(), s.x.data(),
@@ -132,41 +453,16 @@
          float *Q = s.qkv.data(), *K = Q+E, *V = K+E;
  
          // Cache K, V
-         size_t loff = (size_t)l*cfg.n_ctx*E;
-         std::copy(K, K+E, s.key_cache.data()+loff+(size_t)pos*E);
-         std::copy(V, V+E, s.val_cache.data()+loff+(size_t)pos*E);
+         s.kv.store(0, l, pos, K, V);
  
          std::fill(s.attn_out.begin(), s.attn_out.end(), 0.f);
          float scale = 1.f / sqrtf((float)hs);
  
-         for (int h = 0; h < H; h++) {
-             // Pointers for this head's slice of Q, and its output slot in att_score
-             const float *q  = Q + h*hs;                           // this head's query vector (hs elements)
-             float *sc       = s.att_score.data() + h*cfg.n_ctx;   // this head's attention scores [0..pos]
-             const float *kc = s.key_cache.data() + loff;          // this layer's cached keys (all positions)
-         
-             // ── Step 1: Compute attention scores (Q·K^T / sqrt(hs)) ──
-             for (int t = 0; t <= pos; t++) {
-                 float dot = 0;
-                 const float *k_t = kc + (size_t)t*E + h*hs;   // key at position t, this head's slice
-                 for (int i = 0; i < hs; i++) dot += q[i]*k_t[i];
-                 sc[t] = dot * scale;                          // scaled dot product → raw attention score
-             }
-         
-             // ── Step 2: Softmax over all positions ──
-             float mx = *std::max_element(sc, sc+pos+1), sm = 0;
-             for (int t = 0; t<=pos; t++) { sc[t]=expf(sc[t]-mx); sm+=sc[t]; }  // subtract max for stability
-             for (int t = 0; t<=pos; t++) sc[t] /= sm;                           // normalize to sum to 1
-         
-             // ── Step 3: Weighted sum of values → attention output for this head ──
-             float *oh      = s.attn_out.data() + h*hs;       // this head's slice of the output
-             const float *vc = s.val_cache.data() + loff;     // this layer's cached values (all positions)
-             for (int t = 0; t <= pos; t++) {
-                 const float *v_t = vc + (size_t)t*E + h*hs;  // value at position t, this head's slice
-                 float a = sc[t];                              // softmax weight for position t
-                 for (int i = 0; i < hs; i++) oh[i] += a*v_t[i];  // accumulate: output += a * V_t
-             }
-         }
+         #pragma omp parallel for schedule(static)
+         for (int h = 0; h < H; h++)
+             attend_head(s.attn_out.data() + h*hs, Q + h*hs,
+                         s.kv, 0, l, h,
+                         s.att_score.data() + h*cfg.n_ctx, pos, hs, scale);
  
          // Output projection + residual
          matmul(s.proj_buf.data(), s.attn_out.data(),
@@ -197,47 +493,206 @@
      return s.logits.data();
  }
  
+ // ── batched forward pass ─────────────────────────────────────────────────────
+ 
+ // One row of a forward_batch call: a token at position pos of sequence seq
+ // (its KV cache slot). Rows with logits set get a row in s.blogits.
+ struct BatchRow {
+     int token, pos, seq;
+     bool logits;
+ };
+ 
+ // Runs T <= s.max_rows rows through the model in one pass. Every projection
+ // is an M=T matmul_batch, so the batch reads each weight once instead of once
+ // per row; the rows can be a prompt block of one sequence or the next tokens
+ // of many. A layer writes all T keys and values to the cache before its
+ // attention runs, and a row attends to positions 0 .. pos of its own
+ // sequence, which is exactly the causal mask. The logits of the rows that
+ // asked for them land in s.blogits, one vocab_size row each, in row order.
+ static void forward_batch(const BatchRow *rows, int T,
+                           const Config &cfg, const Weights &w, State &s)
+ {
+     const int E = cfg.n_embd, H = cfg.n_head, hs = E/H;
+     float *X = s.bx.data(), *XB = s.bxb.data(), *QKV = s.bqkv.data();
+     float *A = s.battn.data(), *M = s.bmlp.data(), *P = s.bproj.data();
+ 
+     // 1. Embedding
+     for (int t = 0; t < T; t++) {
+         const float *te = w.wte.data() + (size_t)rows[t].token*E;
+         const float *pe = w.wpe.data() + (size_t)rows[t].pos*E;
+         for (int i = 0; i < E; i++) X[(size_t)t*E+i] = te[i] + pe[i];
+     }
+ 
+     // 2. Layers
+     for (int t = 0; t < T; t++) {
+         s.kv.reserve(rows[t].seq, rows[t].pos+1);
+         s.kv.make_writable(rows[t].seq, rows[t].pos);
+     }
+     for (int l = 0; l < cfg.n_layer; l++) {
+         // ── Attention ─────────────────────────────────────────────────────
+         #pragma omp parallel for schedule(static)
+         for (int t = 0; t < T; t++)
+             layernorm(XB+(size_t)t*E, X+(size_t)t*E,
+                       w.ln1_w.data()+(size_t)l*E, w.ln1_b.data()+(size_t)l*E, E);
+ 
+         matmul_batch(QKV, XB,
+                      w.c_attn_w.data()+(size_t)l*3*E*E,
+                      w.c_attn_b.data()+(size_t)l*3*E, T, E, 3*E);
+ 
+         // Cache K, V for every row
+         for (int t = 0; t < T; t++) {
+             const float *K = QKV + (size_t)t*3*E + E, *V = K + E;
+             s.kv.store(rows[t].seq, l, rows[t].pos, K, V);
+         }
+ 
+         std::fill(A, A+(size_t)T*E, 0.f);
+         float scale = 1.f / sqrtf((float)hs);
+         // Heads in parallel; each head keeps its att_score row to itself.
+         #pragma omp parallel for schedule(static)
+         for (int h = 0; h < H; h++)
+             for (int t = 0; t < T; t++)
+                 attend_head(A + (size_t)t*E + h*hs, QKV + (size_t)t*3*E + h*hs,
+                             s.kv, rows[t].seq, l, h,
+                             s.att_score.data() + h*cfg.n_ctx, rows[t].pos, hs, scale);
+ 
+         // Output projection + residual
+         matmul_batch(P, A,
+                      w.c_proj_w.data()+(size_t)l*E*E,
+                      w.c_proj_b.data()+(size_t)l*E, T, E, E);
+         for (size_t i = 0; i < (size_t)T*E; i++) X[i] += P[i];
+ 
+         // ── FFN ───────────────────────────────────────────────────────────
+         #pragma omp parallel for schedule(static)
+         for (int t = 0; t < T; t++)
+             layernorm(XB+(size_t)t*E, X+(size_t)t*E,
+                       w.ln2_w.data()+(size_t)l*E, w.ln2_b.data()+(size_t)l*E, E);
+ 
+         matmul_batch(M, XB,
+                      w.mlp_fc_w.data()+(size_t)l*4*E*E,
+                      w.mlp_fc_b.data()+(size_t)l*4*E, T, E, 4*E);
+         #pragma omp parallel for schedule(static)
+         for (size_t i = 0; i < (size_t)T*4*E; i++) M[i] = gelu(M[i]);
+ 
+         matmul_batch(P, M,
+                      w.mlp_pj_w.data()+(size_t)l*E*4*E,
+                      w.mlp_pj_b.data()+(size_t)l*E, T, 4*E, E);
+         for (size_t i = 0; i < (size_t)T*E; i++) X[i] += P[i];
+     }
+ 
+     // 3. Final layer norm and 4. logits, only for the rows that are sampled:
+     // gather them into XB and run the tied projection once for all of them.
+     int n_out = 0;
+     for (int t = 0; t < T; t++)
+         if (rows[t].logits)
+             layernorm(XB+(size_t)(n_out++)*E, X+(size_t)t*E, w.ln_f_w.data(), w.ln_f_b.data(), E);
+     if (n_out)
+         matmul_batch(s.blogits.data(), XB, w.wte.data(), nullptr, n_out, E, cfg.vocab_size);
+ }
+ 
+ // Prefills n prompt tokens of sequence seq at positions pos0 .. pos0+n-1 in
+ // forward_batch calls of up to block rows, and returns the last token's logits.
+ static float *prefill(const int *tokens, int n, int pos0, int seq, int block,
+                       const Config &cfg, const Weights &w, State &s)
+ {
+     std::vector<BatchRow> rows;
+     for (int i = 0; i < n; i += block) {
+         int T = std::min(n - i, block);
+         rows.clear();
+         for (int t = 0; t < T; t++)
+             rows.push_back({tokens[i+t], pos0+i+t, seq, i+t == n-1});
+         forward_batch(rows.data(), T, cfg, w, s);
+     }
+     return s.blogits.data();
+ }
+ 
  // ── weight loading ────────────────────────────────────────────────────────────
  
- static std::vector<float> read_tensor(std::ifstream &f, const char *name) {
-     uint32_t nd; read_exact(f, &nd, 4);
+ // Weights file (little endian): u32 magic 0x67707432, u32 version, five u32
+ // config values, then per tensor u32 ndim, ndim x u32 dims and float32 data.
+ // Version 2 zero-pads before each tensor's data so it starts on a
+ // WEIGHTS_ALIGN boundary; version 1 data is only 4-byte aligned. Either way
+ // the file is mmap'ed and tensors point straight into the mapping: nothing is
+ // copied, start-up costs only the header parse, and processes mapping the
+ // same file share one page-cache copy of it.
+ static const size_t WEIGHTS_ALIGN = 64;
+ 
+ struct MapCursor {
+     const uint8_t *base;
+     size_t off, size;
+ };
+ 
+ static const void *map_take(MapCursor &c, size_t n) {
+     if (n > c.size - c.off) { std::cerr << "Unexpected EOF\n"; std::exit(1); }
+     const void *p = c.base + c.off;
+     c.off += n;
+     return p;
+ }
+ 
+ static void map_read(MapCursor &c, void *dst, size_t n) {
+     std::memcpy(dst, map_take(c, n), n);
+ }
+ 
+ static Tensor read_tensor(MapCursor &c, uint32_t ver, const char *name) {
+     uint32_t nd; map_read(c, &nd, 4);
      size_t total = 1;
      for (uint32_t d=0;d<nd;d++) {
-         uint32_t dim; read_exact(f,&dim,4); total*=dim;
+         uint32_t dim; map_read(c,&dim,4); total*=dim;
      }
-     std::vector<float> v(total);
-     read_exact(f, v.data(), total*4);
-     std::cout << "  loaded " << name << " (" << total << ")\n";
-     return v;
+     if (ver >= 2) map_take(c, (WEIGHTS_ALIGN - c.off % WEIGHTS_ALIGN) % WEIGHTS_ALIGN);
+     Tensor t;
+     t.ptr = static_cast<const float *>(map_take(c, total*4));
+     t.n   = total;
+     std::cout << "  mapped " << name << " (" << total << ")\n";
+     return t;
  }
  
  static void load_weights(const std::string &path, Config &cfg, Weights &w) {
-     std::ifstream f(path, std::ios::binary);
-     if (!f) { std::cerr << "Cannot open " << path << "\n"; std::exit(1); }
+     auto t0 = std::chrono::high_resolution_clock::now();
+     int fd = open(path.c_str(), O_RDONLY);
+     if (fd < 0) { std::cerr << "Cannot open " << path << "\n"; std::exit(1); }
+     struct stat st;
+     if (fstat(fd, &st) != 0 || st.st_size == 0) {
+         std::cerr << "Cannot stat " << path << "\n"; std::exit(1);
+     }
+     w.map_size = (size_t)st.st_size;
+     w.map = mmap(nullptr, w.map_size, PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+     if (w.map == MAP_FAILED) {
+         w.map = nullptr;
+         std::cerr << "Cannot map " << path << "\n"; std::exit(1);
+     }
+     madvise(w.map, w.map_size, MADV_WILLNEED);   // start read-ahead, don't wait for it
+ 
+     MapCursor c{static_cast<const uint8_t *>(w.map), 0, w.map_size};
      uint32_t magic, ver;
-     read_exact(f,&magic,4); read_exact(f,&ver,4);
+     map_read(c,&magic,4); map_read(c,&ver,4);
      if (magic != 0x67707432u) { std::cerr << "Bad magic\n"; std::exit(1); }
-     read_exact(f,&cfg.vocab_size,4); read_exact(f,&cfg.n_ctx,4);
-     read_exact(f,&cfg.n_embd,4);    read_exact(f,&cfg.n_layer,4);
-     read_exact(f,&cfg.n_head,4);
+     if (ver != 1 && ver != 2) { std::cerr << "Unsupported weights version " << ver << "\n"; std::exit(1); }
+     map_read(c,&cfg.vocab_size,4); map_read(c,&cfg.n_ctx,4);
+     map_read(c,&cfg.n_embd,4);    map_read(c,&cfg.n_layer,4);
+     map_read(c,&cfg.n_head,4);
      std::cout << "GPT-2  embd=" << cfg.n_embd << "  layers=" << cfg.n_layer
                << "  heads=" << cfg.n_head << "  vocab=" << cfg.vocab_size << "\n";
-     w.wte      = read_tensor(f,"wte");
-     w.wpe      = read_tensor(f,"wpe");
-     w.ln1_w    = read_tensor(f,"ln1_w");
-     w.ln1_b    = read_tensor(f,"ln1_b");
-     w.c_attn_w = read_tensor(f,"c_attn_w");
-     w.c_attn_b = read_tensor(f,"c_attn_b");
-     w.c_proj_w = read_tensor(f,"c_proj_w");
-     w.c_proj_b = read_tensor(f,"c_proj_b");
-     w.ln2_w    = read_tensor(f,"ln2_w");
-     w.ln2_b    = read_tensor(f,"ln2_b");
-     w.mlp_fc_w = read_tensor(f,"mlp_fc_w");
-     w.mlp_fc_b = read_tensor(f,"mlp_fc_b");
-     w.mlp_pj_w = read_tensor(f,"mlp_pj_w");
-     w.mlp_pj_b = read_tensor(f,"mlp_pj_b");
-     w.ln_f_w   = read_tensor(f,"ln_f_w");
-     w.ln_f_b   = read_tensor(f,"ln_f_b");
+     w.wte      = read_tensor(c, ver, "wte");
+     w.wpe      = read_tensor(c, ver, "wpe");
+     w.ln1_w    = read_tensor(c, ver, "ln1_w");
+     w.ln1_b    = read_tensor(c, ver, "ln1_b");
+     w.c_attn_w = read_tensor(c, ver, "c_attn_w");
+     w.c_attn_b = read_tensor(c, ver, "c_attn_b");
+     w.c_proj_w = read_tensor(c, ver, "c_proj_w");
+     w.c_proj_b = read_tensor(c, ver, "c_proj_b");
+     w.ln2_w    = read_tensor(c, ver, "ln2_w");
+     w.ln2_b    = read_tensor(c, ver, "ln2_b");
+     w.mlp_fc_w = read_tensor(c, ver, "mlp_fc_w");
+     w.mlp_fc_b = read_tensor(c, ver, "mlp_fc_b");
+     w.mlp_pj_w = read_tensor(c, ver, "mlp_pj_w");
+     w.mlp_pj_b = read_tensor(c, ver, "mlp_pj_b");
+     w.ln_f_w   = read_tensor(c, ver, "ln_f_w");
+     w.ln_f_b   = read_tensor(c, ver, "ln_f_b");
+     double ms = std::chrono::duration<double, std::milli>(
+         std::chrono::high_resolution_clock::now()-t0).count();
+     std::cout << "Mapped " << w.map_size / 1048576.0 << " MiB of weights (v" << ver
+               << ") in " << ms << " ms\n";
  }
  
  // ── tokeniser ─────────────────────────────────────────────────────────────────
@@ -330,7 +785,7 @@
  // ── generation ────────────────────────────────────────────────────────────────
  
 static void generate(const std::string &prompt, int max_new,
-                     float temp, float topp,
+                     float temp, float topp, int prefill_block,
                      const Config &cfg, const Weights &weights,
                      const Tokenizer &tok, State &state)
  {
@@ -339,8 +794,19 @@ static void generate(const std::string &prompt, int max_new,
      std::cout << "\n[" << tokens.size() << " prompt tokens]\n" << prompt;
  
      auto t0 = std::chrono::high_resolution_clock::now();
+     if (tokens.empty() || tokens.size() >= (size_t)cfg.n_ctx) {
+         std::cerr << "Prompt must be 1 to " << cfg.n_ctx - 1 << " tokens\n"; std::exit(1);
+     }
      int pos=0; float *logits=nullptr;
-     for (int t : tokens) { logits=forward(t,pos,cfg,weights,state); pos++; }
+     if (prefill_block <= 1) {
+         for (int t : tokens) { logits=forward(t,pos,cfg,weights,state); pos++; }
+     } else {
+         logits = prefill(tokens.data(), (int)tokens.size(), 0, 0, prefill_block,
+                          cfg, weights, state);
+         pos = (int)tokens.size();
+     }
+     double prefill_ms = std::chrono::duration<double, std::milli>(
+         std::chrono::high_resolution_clock::now()-t0).count();
  
      int gen=0;
      for (int step=0; step<max_new; step++) {
@@ -355,6 +821,312 @@ static void generate(const std::string &prompt, int max_new,
      double secs = std::chrono::duration<double>(
          std::chrono::high_resolution_clock::now()-t0).count();
     std::cout << "\n\n[" << gen << " tokens, " << gen/secs << " tok/s]\n";
+    std::cout << "[prefill: " << tokens.size() << " prompt tokens in " << prefill_ms
+              << " ms, " << tokens.size()*1000.0/prefill_ms << " tok/s]\n";
+}
+
+// ── thread scaling ───────────────────────────────────────────────────────────
+
+// Decode throughput at 1, 2, 4, ... threads and at max_threads. Each run
+// prefills the prompt, then times max_new greedy decode steps on their own,
+// so the rows differ only in the thread count.
+static void thread_scaling(const std::string &prompt, int max_new, int max_threads,
+                           const Config &cfg, const Weights &weights,
+                           const Tokenizer &tok, State &state)
+{
+#ifdef _OPENMP
+    auto tokens = tok.encode(prompt);
+    if (tokens.empty() || tokens.size() >= (size_t)cfg.n_ctx) {
+        std::cerr << "Prompt must be 1 to " << cfg.n_ctx - 1 << " tokens\n"; std::exit(1);
+    }
+    max_new = std::min(max_new, cfg.n_ctx - (int)tokens.size());
+    std::vector<int> counts;
+    for (int t = 1; t < max_threads; t *= 2) counts.push_back(t);
+    counts.push_back(max_threads);
+
+    std::cout << "\nDecode scaling: " << tokens.size() << " prompt tokens, "
+              << max_new << " decode steps\n";
+    std::printf("%8s %10s %9s %11s\n", "threads", "tok/s", "speedup", "efficiency");
+    double base = 0;
+    for (int nt : counts) {
+        omp_set_num_threads(nt);
+        int pos = (int)tokens.size();
+        float *logits = prefill(tokens.data(), pos, 0, 0, PREFILL_BLOCK, cfg, weights, state);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int step = 0; step < max_new; step++)
+            logits = forward(argmax(logits, cfg.vocab_size), pos++, cfg, weights, state);
+        double secs = std::chrono::duration<double>(
+            std::chrono::high_resolution_clock::now()-t0).count();
+        double tps = max_new / secs;
+        if (base == 0) base = tps;
+        std::printf("%8d %10.2f %8.2fx %10.0f%%\n", nt, tps, tps / base, 100.0 * tps / base / nt);
+    }
+    omp_set_num_threads(max_threads);
+#else
+    (void)prompt; (void)max_new; (void)max_threads; (void)cfg; (void)weights; (void)tok; (void)state;
+    std::cerr << "--scaling needs a build with OpenMP\n"; std::exit(1);
+#endif
+}
+
+// ── continuous batching server ───────────────────────────────────────────────
+
+// A request from the load generator. Times are seconds since serve started.
+struct Request {
+    int id = 0;
+    std::vector<int> prompt;
+    double arrival = 0;
+    int seq = -1;              // KV cache slot while active
+    int prefilled = 0;         // prompt tokens already in the cache
+    int pos = 0;               // tokens in the cache = position of the next row
+    int next = -1;             // sampled token to feed back next step, -1 while prefilling
+    int pages = 0;             // KV pages the request can grow to
+    int cached = 0;            // prompt tokens found in the prefix cache
+    std::vector<int> out;
+    double first = -1, done = -1;
+};
+
+// Nearest-rank percentile.
+static double percentile(std::vector<double> v, double p) {
+    std::sort(v.begin(), v.end());
+    size_t k = (size_t)std::ceil(p / 100.0 * v.size());
+    return v[std::max<size_t>(k, 1) - 1];
+}
+
+// Serves n_requests prompts (read one per line from path, or stdin for "-",
+// and cycled) arriving as a Poisson process at rate requests/s, or all at
+// once for rate 0. Up to max_batch requests are active at a time, each with
+// its own page table into a pool of kv_pages KV pages. A request is admitted
+// only while the pages it can grow to (prompt plus max_new tokens) fit in
+// the pool next to those of the active ones, so no request ever runs out of
+// pages mid-flight. With prefix_cache, finished prompts publish their full
+// KV pages and a new request starts from the longest cached prefix of its
+// prompt. Every step is one forward_batch over a decode row
+// for each request that is generating plus prompt rows of requests that are
+// still prefilling, up to PREFILL_BLOCK of them; requests are admitted into
+// free slots and retired between steps, so a long generation never holds up a
+// new arrival. Reports each request and then throughput, prefix cache hits
+// and TTFT / latency percentiles.
+static void serve(const std::string &path, int n_requests, double rate, int max_batch,
+                  int kv_pages, KVType kv_type, bool prefix_cache, int max_new, float temp, float topp,
+                  const Config &cfg, const Weights &weights, const Tokenizer &tok)
+{
+    std::vector<std::string> prompts;
+    std::string line;
+    if (path == "-") {
+        while (std::getline(std::cin, line)) if (!line.empty()) prompts.push_back(line);
+    } else {
+        std::ifstream f(path);
+        if (!f) { std::cerr << "Cannot open " << path << "\n"; std::exit(1); }
+        while (std::getline(f, line)) if (!line.empty()) prompts.push_back(line);
+    }
+    if (prompts.empty()) { std::cerr << "No prompts in " << path << "\n"; std::exit(1); }
+    if (n_requests <= 0) n_requests = (int)prompts.size();
+
+    std::mt19937 arrivals(1234);
+    std::exponential_distribution<double> gap(rate > 0 ? rate : 1.0);
+    std::vector<Request> reqs(n_requests);
+    double at = 0;
+    for (int i = 0; i < n_requests; i++) {
+        Request &r = reqs[i];
+        r.id = i;
+        r.prompt = tok.encode(prompts[i % prompts.size()]);
+        if (r.prompt.empty() || r.prompt.size() >= (size_t)cfg.n_ctx) {
+            std::cerr << "Prompt must be 1 to " << cfg.n_ctx - 1 << " tokens\n"; std::exit(1);
+        }
+        int n = std::min((int)r.prompt.size() + std::max(max_new, 1), cfg.n_ctx);
+        r.pages = (n + KV_PAGE - 1) / KV_PAGE + (prefix_cache ? 1 : 0);   // + a copy-on-write page
+        if (rate > 0) at += gap(arrivals);
+        r.arrival = at;
+    }
+
+    // By default every slot can reach n_ctx, copy-on-write page included.
+    if (kv_pages <= 0)
+        kv_pages = max_batch * ((cfg.n_ctx + KV_PAGE - 1) / KV_PAGE + (prefix_cache ? 1 : 0));
+    State state; state.init(cfg, max_batch, max_batch + PREFILL_BLOCK, kv_pages, kv_type);
+    // A request that cannot fit in the whole pool would never be admitted.
+    for (const Request &r : reqs)
+        if (r.pages > state.kv.max_pages) {
+            std::cerr << "Request " << r.id << " needs " << r.pages << " KV pages, more than the "
+                      << state.kv.max_pages << " in the pool\n"; std::exit(1);
+        }
+    const double page_mib = state.kv.page_bytes() / (1024.0*1024.0);
+    std::cout << "KV cache: " << state.kv.max_pages << " pages of " << KV_PAGE << " positions ("
+              << KV_TYPE_NAMES[kv_type] << "), "
+              << page_mib << " MiB each, up to " << state.kv.max_pages * page_mib << " MiB\n";
+    std::vector<int> free_slots;
+    for (int i = max_batch - 1; i >= 0; i--) free_slots.push_back(i);
+    std::vector<Request*> active, owners;       // owners[i]: request of logits row i
+    std::vector<BatchRow> rows;
+    std::mt19937 rng(std::random_device{}());
+    size_t next_req = 0;
+    int finished = 0, committed = 0;           // committed: pages of the active requests
+    long steps = 0, total_rows = 0, prompt_tokens = 0, gen_tokens = 0;
+    long cached_tokens = 0, hits = 0;
+    double prefill_secs = 0;                    // forward_batch time, prorated to prompt rows
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    auto now = [&] {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t0).count();
+    };
+    while (finished < n_requests) {
+        // Admit the requests that have arrived while there are free slots
+        while (next_req < reqs.size() && !free_slots.empty() && reqs[next_req].arrival <= now()
+               && committed + reqs[next_req].pages <= state.kv.max_pages) {
+            Request &r = reqs[next_req++];
+            r.seq = free_slots.back(); free_slots.pop_back();
+            committed += r.pages;
+            if (prefix_cache) {
+                // At least the last prompt token runs, to produce the first logits.
+                int n = (int)r.prompt.size();
+                r.cached = std::min(state.kv.attach_prefix(r.seq, r.prompt.data(), n), n - 1);
+                r.prefilled = r.pos = r.cached;
+                cached_tokens += r.cached;
+                if (r.cached > 0) hits++;
+            }
+            active.push_back(&r);
+        }
+        if (active.empty()) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(reqs[next_req].arrival - now()));
+            continue;
+        }
+
+        // One decode row per generating request, then prompt rows
+        rows.clear(); owners.clear();
+        for (Request *r : active)
+            if (r->next >= 0) { rows.push_back({r->next, r->pos++, r->seq, true}); owners.push_back(r); }
+        int budget = PREFILL_BLOCK, n_prompt = 0;
+        for (Request *r : active) {
+            if (r->next >= 0 || budget == 0) continue;
+            int n = std::min((int)r->prompt.size() - r->prefilled, budget);
+            for (int i = 0; i < n; i++, r->prefilled++) {
+                bool last = r->prefilled == (int)r->prompt.size() - 1;
+                rows.push_back({r->prompt[r->prefilled], r->prefilled, r->seq, last});
+                if (last) owners.push_back(r);
+            }
+            r->pos = r->prefilled;
+            budget -= n; n_prompt += n;
+        }
+        auto f0 = std::chrono::high_resolution_clock::now();
+        forward_batch(rows.data(), (int)rows.size(), cfg, weights, state);
+        prefill_secs += std::chrono::duration<double>(
+            std::chrono::high_resolution_clock::now()-f0).count() * n_prompt / rows.size();
+        steps++; total_rows += (long)rows.size(); prompt_tokens += n_prompt;
+
+        // Sample each logits row; retire the requests that are done
+        double t = now();
+        for (size_t i = 0; i < owners.size(); i++) {
+            Request *r = owners[i];
+            if (prefix_cache && r->next < 0)     // prompt done: its full pages are reusable
+                state.kv.publish_prefix(r->seq, r->prompt.data(), (int)r->prompt.size());
+            const float *logits = state.blogits.data() + i*cfg.vocab_size;
+            int next = (temp==0.f) ? argmax(logits,cfg.vocab_size)
+                                   : sample_topp(logits,cfg.vocab_size,temp,topp,rng);
+            if (r->first < 0) r->first = t;
+            bool stop = next == 50256 || max_new <= 0;      // <|endoftext|>
+            if (!stop) {
+                r->out.push_back(next); gen_tokens++;
+                stop = (int)r->out.size() >= max_new || r->pos + 1 >= cfg.n_ctx;
+            }
+            if (stop) {
+                r->done = t; r->next = -1;
+                state.kv.release(r->seq);
+                committed -= r->pages;
+                free_slots.push_back(r->seq);
+                finished++;
+            } else {
+                r->next = next;
+            }
+        }
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [](const Request *r) { return r->done >= 0; }),
+                     active.end());
+    }
+    double secs = now();
+
+    std::vector<double> ttft, latency;
+    std::cout << "\n";
+    for (const Request &r : reqs) {
+        ttft.push_back((r.first - r.arrival) * 1000);
+        latency.push_back((r.done - r.arrival) * 1000);
+        std::string text;
+        for (int id : r.out) {
+            for (char c : tok.piece(id)) {
+                if (c == '\n') text += "\\n";
+                else text += c;
+            }
+        }
+        std::printf("#%-4d ttft %8.1f ms  latency %8.1f ms  %4zu tokens  %s\n",
+                    r.id, ttft.back(), latency.back(), r.out.size(), text.c_str());
+    }
+    std::printf("\n[%d requests in %.2f s, batch %d, rate %g/s]\n", n_requests, secs, max_batch, rate);
+    std::printf("[prompt: %ld tokens, %.1f tok/s; generated: %ld tokens, %.1f tok/s]\n",
+                prompt_tokens, prompt_tokens / secs, gen_tokens, gen_tokens / secs);
+    if (prefix_cache) {
+        // Saving = cached tokens at the measured prefill cost per prompt token.
+        const double saved_ms = prompt_tokens ? cached_tokens * prefill_secs / prompt_tokens * 1000 : 0;
+        std::printf("[prefix cache: %ld of %d requests hit, %ld of %ld prompt tokens cached (%.1f%%), "
+                    "~%.1f ms TTFT saved per hit]\n",
+                    hits, n_requests, cached_tokens, cached_tokens + prompt_tokens,
+                    100.0 * cached_tokens / (cached_tokens + prompt_tokens), hits ? saved_ms / hits : 0.0);
+    }
+    std::printf("[%ld steps, %.1f rows per step]\n", steps, (double)total_rows / steps);
+    std::printf("[KV cache: %d of %d pages allocated at peak, %.1f MiB]\n",
+                state.kv.allocated(), state.kv.max_pages, state.kv.allocated() * page_mib);
+    std::printf("[ttft ms:    p50 %8.1f  p90 %8.1f  p99 %8.1f]\n",
+                percentile(ttft, 50), percentile(ttft, 90), percentile(ttft, 99));
+    std::printf("[latency ms: p50 %8.1f  p90 %8.1f  p99 %8.1f]\n",
+                percentile(latency, 50), percentile(latency, 90), percentile(latency, 99));
+}
+
+// ── perplexity ───────────────────────────────────────────────────────────────
+
+// Perplexity of the text in path with float32 keys and values and with
+// kv_type, to show what storing the cache as kv_type costs. The text is cut
+// into windows of n_ctx tokens, each run from position 0, and every token but
+// the first of a window is scored against the logits of the one before it.
+static void perplexity(const std::string &path, KVType kv_type,
+                       const Config &cfg, const Weights &weights, const Tokenizer &tok)
+{
+    std::ifstream f(path);
+    if (!f) { std::cerr << "Cannot open " << path << "\n"; std::exit(1); }
+    std::string text((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    auto tokens = tok.encode(text);
+    if (tokens.size() < 2) { std::cerr << "Perplexity needs at least 2 tokens\n"; std::exit(1); }
+    const int V = cfg.vocab_size;
+
+    std::vector<KVType> types = {KV_F32};
+    if (kv_type != KV_F32) types.push_back(kv_type);
+    std::printf("\nPerplexity of %s: %zu tokens, windows of %d\n", path.c_str(), tokens.size(), cfg.n_ctx);
+    std::printf("%4s %10s %12s %9s\n", "kv", "KiB/token", "perplexity", "change");
+    double base = 0;
+    for (KVType t : types) {
+        State s; s.init(cfg, 1, PREFILL_BLOCK, 0, t);
+        s.blogits.assign((size_t)PREFILL_BLOCK * V, 0);   // every row asks for logits
+        std::vector<BatchRow> rows;
+        double nll = 0;
+        long scored = 0;
+        for (size_t w0 = 0; w0 + 1 < tokens.size(); w0 += cfg.n_ctx) {
+            const int len = (int)std::min(tokens.size() - w0, (size_t)cfg.n_ctx);
+            for (int i = 0; i < len; i += PREFILL_BLOCK) {
+                const int T = std::min(len - i, PREFILL_BLOCK);
+                rows.clear();
+                for (int r = 0; r < T; r++) rows.push_back({tokens[w0+i+r], i+r, 0, true});
+                forward_batch(rows.data(), T, cfg, weights, s);
+                for (int r = 0; r < T && i+r+1 < len; r++) {
+                    const float *logits = s.blogits.data() + (size_t)r*V;
+                    const float mx = *std::max_element(logits, logits+V);
+                    double sum = 0;
+                    for (int v = 0; v < V; v++) sum += std::exp((double)(logits[v] - mx));
+                    nll += mx + std::log(sum) - logits[tokens[w0+i+r+1]];
+                    scored++;
+                }
+            }
+        }
+        const double ppl = std::exp(nll / scored);
+        if (base == 0) base = ppl;
+        std::printf("%4s %10.2f %12.4f %+8.3f%%\n", KV_TYPE_NAMES[t],
+                    s.kv.page_bytes() / (double)KV_PAGE / 1024.0, ppl, 100.0 * (ppl / base - 1));
+    }
 }
 
 // ── main ──────────────────────────────────────────────────────────────────────
@@ -366,6 +1138,10 @@ static std::string default_model_path(const std::string &model, const std::strin
 static void usage(const char *p) {
     fprintf(stderr,
         "Usage: %s [--model NAME] [--weights PATH --vocab PATH] [prompt] [-n N] [-t T] [-p P]\n"
+        "          [--prefill-block N] [--threads N] [--scaling]\n"
+        "          [--serve FILE|- [--batch B] [--rate R] [--requests N] [--kv-pages N]\n"
+        "           [--no-prefix-cache]]\n"
+        "          [--kv-type f32|f16|q8] [--perplexity FILE]\n"
         "   or: %s weights.bin vocab.bin [prompt] [-n N] [-t T] [-p P]\n", p, p);
     std::exit(1);
 }
@@ -377,6 +1153,16 @@ int main(int argc, char **argv) {
     std::string prompt = "Once upon a time";
     int max_new = 200;
     float temp = 1.0f, topp = 0.9f;
+    int prefill_block = PREFILL_BLOCK;
+    int threads = 0;               // 0 = OpenMP default
+    bool scaling = false;
+    std::string serve_path;        // prompts file, "-" for stdin
+    int max_batch = 8, n_requests = 0;
+    int kv_pages = 0;              // 0 = room for every slot to reach n_ctx
+    bool prefix_cache = true;
+    KVType kv_type = KV_F32;
+    std::string ppl_path;          // text file to report perplexity on
+    double rate = 0;               // requests/s, 0 = all at once
 
     int i = 1;
     if (argc >= 3 && argv[1][0] != '-' && argv[2][0] != '-') {
@@ -410,6 +1196,46 @@ int main(int argc, char **argv) {
         } else if (f == "-p") {
             if (++i >= argc) usage(argv[0]);
             topp = std::stof(argv[i]);
+        } else if (f == "--prefill-block") {
+            if (++i >= argc) usage(argv[0]);
+            prefill_block = std::stoi(argv[i]);
+            if (prefill_block < 1 || prefill_block > PREFILL_BLOCK) usage(argv[0]);
+        } else if (f == "--threads") {
+            if (++i >= argc) usage(argv[0]);
+            threads = std::stoi(argv[i]);
+            if (threads < 1) usage(argv[0]);
+        } else if (f == "--scaling") {
+            scaling = true;
+        } else if (f == "--serve") {
+            if (++i >= argc) usage(argv[0]);
+            serve_path = argv[i];
+        } else if (f == "--batch") {
+            if (++i >= argc) usage(argv[0]);
+            max_batch = std::stoi(argv[i]);
+            if (max_batch < 1) usage(argv[0]);
+        } else if (f == "--rate") {
+            if (++i >= argc) usage(argv[0]);
+            rate = std::stod(argv[i]);
+            if (rate < 0) usage(argv[0]);
+        } else if (f == "--requests") {
+            if (++i >= argc) usage(argv[0]);
+            n_requests = std::stoi(argv[i]);
+        } else if (f == "--kv-pages") {
+            if (++i >= argc) usage(argv[0]);
+            kv_pages = std::stoi(argv[i]);
+            if (kv_pages < 1) usage(argv[0]);
+        } else if (f == "--no-prefix-cache") {
+            prefix_cache = false;
+        } else if (f == "--kv-type") {
+            if (++i >= argc) usage(argv[0]);
+            std::string t = argv[i];
+            if      (t == "f32") kv_type = KV_F32;
+            else if (t == "f16") kv_type = KV_F16;
+            else if (t == "q8")  kv_type = KV_Q8;
+            else usage(argv[0]);
+        } else if (f == "--perplexity") {
+            if (++i >= argc) usage(argv[0]);
+            ppl_path = argv[i];
         } else if (!f.empty() && f[0] != '-') {
             prompt = f;
         } else {
@@ -417,11 +1243,28 @@ int main(int argc, char **argv) {
         }
     }
 
+#ifdef _OPENMP
+    if (threads > 0) omp_set_num_threads(threads);
+    threads = omp_get_max_threads();
+    std::cout << "Threads: " << threads << "\n";
+#else
+    if (threads > 1) std::cerr << "Built without OpenMP; --threads ignored\n";
+    threads = 1;
+#endif
     Config cfg; Weights weights;
     std::cout << "Weights path: " << wp << "\n";
     std::cout << "Vocab path: " << vp << "\n";
     load_weights(wp, cfg, weights);
     Tokenizer tok; tok.load(vp);
-    State state; state.init(cfg);
-    generate(prompt, max_new, temp, topp, cfg, weights, tok, state);
+    if (!ppl_path.empty()) {
+        perplexity(ppl_path, kv_type, cfg, weights, tok);
+        return 0;
+    }
+    if (!serve_path.empty()) {
+        serve(serve_path, n_requests, rate, max_batch, kv_pages, kv_type, prefix_cache, max_new, temp, topp, cfg, weights, tok);
+        return 0;
+    }
+    State state; state.init(cfg, 1, PREFILL_BLOCK, 0, kv_type);
+    if (scaling) thread_scaling(prompt, max_new, threads, cfg, weights, tok, state);
+    else generate(prompt, max_new, temp, topp, prefill_block, cfg, weights, tok, state);
 }